@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <vector>
+
+#include "export_params.hpp"
+#include "logger.hpp"
+#include "palette.hpp"
+
+ExportParams params;
+
+#define NUM_BANKS 16
+#define BANK_COLORS 16
+
+static unsigned int seed = 1;
+static unsigned int Random()
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7FFF;
+}
+
+/** Palettes drawn from NUM_BANKS made up banks of 15 colors plus transparent, so a packing always exists.
+  * Neighbouring banks share half their colors, which leads the greedy pass to mix the banks up. */
+static std::vector<std::vector<Color16>> MakePalettes(unsigned int count, const Color16& transparent)
+{
+    std::vector<std::vector<Color16>> palettes;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        unsigned int bank = Random() % NUM_BANKS;
+        unsigned int size = 3 + Random() % 10;
+        std::vector<Color16> palette(1, transparent);
+        while (palette.size() <= size)
+        {
+            unsigned int c = bank * 8 + Random() % 15;
+            Color16 color(c % 32, c / 32, 1);
+            if (std::find(palette.begin(), palette.end(), color) == palette.end())
+                palette.push_back(color);
+        }
+        palettes.push_back(palette);
+    }
+    return palettes;
+}
+
+static bool Pack(const std::vector<std::vector<Color16>>& palettes, const Color16& transparent, std::vector<int>& bank)
+{
+    PaletteBankManager banks("test");
+    for (unsigned int i = 0; i < banks.Size(); i++)
+        banks[i].Add(transparent);
+    return PackPaletteBanks(palettes, banks, 60000, bank);
+}
+
+int main(int argc, char** argv)
+{
+    logger->SetLogLevel(LogLevel::WARNING);
+    const Color16 transparent(31, 0, 31);
+    int failures = 0;
+
+    for (unsigned int test = 0; test < 20; test++)
+    {
+        seed = test + 1;
+        std::vector<std::vector<Color16>> palettes = MakePalettes(200, transparent);
+
+        std::vector<int> bank;
+        if (!Pack(palettes, transparent, bank))
+        {
+            printf("test %d: no packing found\n", test);
+            failures++;
+            continue;
+        }
+
+        // No bank may end up with more than 16 colors.
+        std::vector<std::set<unsigned short>> colors(NUM_BANKS);
+        for (unsigned int i = 0; i < palettes.size(); i++)
+        {
+            if (bank[i] < 0 || bank[i] >= NUM_BANKS)
+            {
+                printf("test %d: palette %d given bank %d\n", test, i, bank[i]);
+                failures++;
+                break;
+            }
+            colors[bank[i]].insert(transparent.ToIndex());
+            for (const auto& color : palettes[i])
+                colors[bank[i]].insert(color.ToIndex());
+        }
+        for (unsigned int i = 0; i < NUM_BANKS; i++)
+        {
+            if (colors[i].size() > BANK_COLORS)
+            {
+                printf("test %d: bank %d has %zu colors\n", test, i, colors[i].size());
+                failures++;
+            }
+        }
+
+        // The same palettes give the same banks every time.
+        std::vector<int> again;
+        Pack(palettes, transparent, again);
+        if (again != bank)
+        {
+            printf("test %d: packing differs between runs\n", test);
+            failures++;
+        }
+    }
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
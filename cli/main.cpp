@@ -98,11 +98,14 @@ static const wxCmdLineEntryDesc cmd_descriptions[] =
     {wxCMD_LINE_SWITCH, "", "dither",            ""},
     {wxCMD_LINE_SWITCH, "", "no_dither",         ""},
     {wxCMD_LINE_OPTION, "", "dither_level",      "", wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "dither_mode",       "", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "dither_matrix",     "", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
 
     // Mode 0/4 options
     {wxCMD_LINE_OPTION, "", "start",             "", wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL},
     {wxCMD_LINE_OPTION, "", "palette",           "", wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL},
     {wxCMD_LINE_OPTION, "", "palette_image",     "", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "quantizer",         "", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
     {wxCMD_LINE_SWITCH, "", "split",             ""},
     {wxCMD_LINE_SWITCH, "", "no_split",          ""},
 
@@ -113,6 +116,19 @@ static const wxCmdLineEntryDesc cmd_descriptions[] =
     {wxCMD_LINE_OPTION, "", "border",            "", wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL},
     {wxCMD_LINE_SWITCH, "", "affine",            ""},
     {wxCMD_LINE_SWITCH, "", "no_affine",         ""},
+    {wxCMD_LINE_SWITCH, "", "flip_tiles",        ""},
+    {wxCMD_LINE_SWITCH, "", "no_flip_tiles",     ""},
+    {wxCMD_LINE_OPTION, "", "pack_time_ms",      "", wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "max_tiles",         "", wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_SWITCH, "", "nearest_tile",      ""},
+    {wxCMD_LINE_SWITCH, "", "no_nearest_tile",   ""},
+    {wxCMD_LINE_SWITCH, "", "world_map",         ""},
+    {wxCMD_LINE_SWITCH, "", "no_world_map",      ""},
+    {wxCMD_LINE_OPTION, "", "map_layout",        "", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "tile_stream",       "", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_OPTION, "", "metatile",          "", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
+    {wxCMD_LINE_SWITCH, "", "vram_plan",         ""},
+    {wxCMD_LINE_SWITCH, "", "no_vram_plan",      ""},
     {wxCMD_LINE_SWITCH, "", "force",             ""},
     {wxCMD_LINE_SWITCH, "", "no_force",          ""},
 
@@ -215,6 +231,16 @@ const std::map<std::string, HelpDesc> help_text = {
                               "due to reducing the number of colors in the image by adding noise. default on\n"
                               "\tFor more information see: http://en.wikipedia.org/wiki/Dither")},
 {"dither_level", HelpDesc("number [0-100]", "Affects the strength of the dithering algorithm used. default 10.")},
+{"dither_mode", HelpDesc("one of riemersma, ordered, floydsteinberg, atkinson, sierralite", "Dithering algorithm used when dithering is enabled. default riemersma.\n"
+                                                                                            "\triemersma      - Error diffusion along a curve through the image.\n"
+                                                                                            "\tordered        - Threshold matrix, much faster and stable across animation frames.\n"
+                                                                                            "\tfloydsteinberg - Error diffusion row by row, large images use all cores.\n"
+                                                                                            "\tatkinson       - Like floydsteinberg but only diffuses 3/4 of the error, keeps more contrast.\n"
+                                                                                            "\tsierralite     - Like floydsteinberg with a smaller kernel.\n"
+                                                                                            "\tThe diffusion kernels scale the error by --dither_level, they usually want 75 or more.\n"
+                                                                                            "See also --dither_matrix")},
+{"dither_matrix", HelpDesc("one of bayer4, bayer8, bluenoise", "Threshold matrix used with --dither_mode=ordered. default bayer8.\n"
+                                                               "\tAt --dither_level=100 thresholds span the whole range of a color component.")},
 {"start", HelpDesc("number [0-255]", "Starts the palette off at index X.\n"
                                      "Useful if you have another image already exported that has X entries.\n"
                                      "This option is only available for mode 4.\n"
@@ -223,6 +249,11 @@ const std::map<std::string, HelpDesc> help_text = {
                                        "Useful for specifying the number of colors for each image.\n"
                                        "This option is only available for mode 4.\n"
                                        "See also --start")},
+{"quantizer", HelpDesc("one of mediancut, wu, octree, kmeans", "Algorithm used to pick the colors of generated palettes. default mediancut.\n"
+                                                               "\tmediancut - Median cut in LAB color space.\n"
+                                                               "\twu        - Xiaolin Wu's variance minimizing quantizer, fast on large images.\n"
+                                                               "\toctree    - Octree quantizer, uses little memory.\n"
+                                                               "\tkmeans    - Median cut refined by k-means in LAB color space, slowest but most accurate.")},
 {"split", HelpDesc("", "Exports each individual image as if the program was called with just that one image.\n"
                              "In mode 4 using this will export each image with its own palette instead of a global palette.\n"
                              "In mode 0 using this will export each map with its own palette and tileset instead of a global tileset/palette.\n"
@@ -242,6 +273,41 @@ const std::map<std::string, HelpDesc> help_text = {
 {"affine", HelpDesc("", "For use with --mode=tiles,map,0,tilemap.\n"
                         "Exports the map for use with affine backgrounds.\n"
                         "Ensures the palette generated is 8 bpp")},
+{"flip_tiles", HelpDesc("", "For use with --mode=tiles,map,0,tilemap.\n"
+                            "\tReuses tiles that are mirrors of other tiles by setting the hflip and vflip bits of map entries.\n"
+                            "\tAffine maps can't flip tiles so this is ignored for them. Default 1.")},
+{"pack_time_ms", HelpDesc("number", "For use with 4bpp tiles and sprites.\n"
+                                    "\tIf assigning tiles to the 16 palette banks greedily fails, time in milliseconds\n"
+                                    "\tthe search for an assignment that fits may take before giving up. The search gives the same result every run\n"
+                                    "\tunless this limit is hit. 0 to only try greedily. Default 1000.")},
+{"max_tiles", HelpDesc("number", "For use with --mode=tiles,map,0,tilemap.\n"
+                                 "\tIf more tiles than this are found, tiles that look the most alike are merged until this many are left.\n"
+                                 "\tMap entries using a merged tile use the closest tile kept instead. 0 to never merge tiles. Default 0.")},
+{"nearest_tile", HelpDesc("", "For use with --mode=map and --tileset_image.\n"
+                              "\tMap tiles not found in the tileset use the tileset tile that looks the closest, flipped when tiles are flipped,\n"
+                              "\tinstead of the empty tile. Default 0.")},
+{"world_map", HelpDesc("", "For use with --mode=0,map,tilemap.\n"
+                           "\tAccepts maps of any size that is a multiple of 8, exported with --map_layout=chunked unless another layout is given.\n"
+                           "\tLoad the chunks around the camera into a 64x64 map to scroll over the whole map. Default 0.")},
+{"map_layout", HelpDesc("one of sbb, rowmajor, colmajor, chunked", "For use with --mode=0,map,tilemap. Order map entries are exported in.\n"
+                                                                   "\tsbb      - Screenblock by screenblock as the hardware reads them. Default without --world_map.\n"
+                                                                   "\trowmajor - Row by row over the whole map.\n"
+                                                                   "\tcolmajor - Column by column over the whole map, so a horizontal scroller copies the next column in one transfer.\n"
+                                                                   "\tchunked  - 32x32 tile screenblock chunks with a table giving the chunk at each position,\n"
+                                                                   "\t           chunks that are the same are exported once. Default with --world_map.")},
+{"tile_stream", HelpDesc("one of none, columns, rows", "For use with --mode=0,map,tilemap, for maps with more than 1024 tiles.\n"
+                                                      "\tA screen sized window can be anywhere on the map and moves a column or row at a time. Tiles get VRAM slots\n"
+                                                      "\tso that the tiles in any window have slots of their own, map entries refer to slots and only the tiles in\n"
+                                                      "\tview at once need to fit. Exports the (slot, tile) pair of each entry to load as it scrolls into view,\n"
+                                                      "\tcolumn by column with columns (for horizontal scrollers) or row by row with rows. Default none.")},
+{"metatile", HelpDesc("one of none, 2x2, 4x4", "For use with --mode=0,tilemap.\n"
+                                              "\tGroups the map entries into blocks of 2x2 or 4x4 tiles, palette and flip bits included,\n"
+                                              "\tand exports each distinct block once in a metatile table shared by the maps.\n"
+                                              "\tEach map is then an array of metatile indices, row or column major as --map_layout says. Default none.")},
+{"vram_plan", HelpDesc("", "For use with --device=gba and --mode=0,map,tiles,tilemap,sprites.\n"
+                           "\tGives each tileset exported a charblock and each map its screenblocks, none overlapping in background VRAM,\n"
+                           "\texported as NAME_CHARBLOCK and NAME_SCREENBLOCK. Fails with what each one needs if they do not fit,\n"
+                           "\tsprites are checked against object VRAM. Default 0.")},
 {"export_2d", HelpDesc("", "Exports sprites for use in sprite 2d mode. Default 0.")},
 {"for_bitmap", HelpDesc("", "Exports sprites for use in modes 3 and 4. Default 0.")},
 {"for_devkitpro", HelpDesc("", "Exported definitions in header file are friendly with devkitpro libraries.\n"
@@ -498,18 +564,31 @@ bool Nin10KitApp::OnCmdLineParsed(wxCmdLineParser& parser)
 
     params.dither = parse.GetSwitch("dither", true);
     params.dither_level = parse.GetInt("dither_level", 10, 0, 100) / 100.0f;
+    params.dither_mode = parse.GetChoice("dither_mode", {"riemersma", "ordered", "floydsteinberg", "atkinson", "sierralite"}, "riemersma");
+    params.dither_matrix = parse.GetChoice("dither_matrix", {"bayer4", "bayer8", "bluenoise"}, "bayer8");
 
     params.export_images = parse.GetSwitch("export_images");
 
     params.offset = parse.GetInt("start", 0, 0, 255);
     params.palette_size = parse.GetInt("palette", 256, 1, 256);
     params.palettes = parse.GetListString("palette_image");
+    params.quantizer = parse.GetChoice("quantizer", {"mediancut", "wu", "octree", "kmeans"}, "mediancut");
     params.split = parse.GetSwitch("split");
 
     params.split_sbb = parse.GetSwitch("split_sbb");
     params.tilesets = parse.GetListString("tileset_image");
     params.border = parse.GetInt("border", 0, 0);
     params.affine = parse.GetSwitch("affine");
+    params.flip_tiles = parse.GetSwitch("flip_tiles", true);
+    params.pack_time_ms = parse.GetInt("pack_time_ms", 1000, 0);
+    params.max_tiles = parse.GetInt("max_tiles", 0, 0);
+    params.nearest_tile = parse.GetSwitch("nearest_tile");
+    params.world_map = parse.GetSwitch("world_map");
+    params.map_layout = parse.GetChoice("map_layout", {"sbb", "rowmajor", "colmajor", "chunked"}, params.world_map ? "chunked" : "sbb");
+    params.tile_stream = parse.GetChoice("tile_stream", {"none", "columns", "rows"}, "none");
+    std::string metatile = parse.GetChoice("metatile", {"none", "2x2", "4x4"}, "none");
+    params.metatile = (metatile == "none") ? 0 : metatile[0] - '0';
+    params.vram_plan = parse.GetSwitch("vram_plan");
     params.force = parse.GetSwitch("force");
 
     params.export_2d = parse.GetSwitch("export_2d");
@@ -678,6 +757,8 @@ bool Nin10KitApp::DoExportImages()
     }
 
     VerboseLog("Converting to Image32Bpp");
+    // World maps are read a band of rows at a time while they are tiled instead of being copied whole.
+    bool banded = params.world_map && !params.affine && (params.mode == "0" || params.mode == "TILEMAP" || params.mode == "MAP");
     for (unsigned int i = 0; i < params.files.size(); i++)
     {
         const std::string& filename = params.files[i];
@@ -687,7 +768,7 @@ bool Nin10KitApp::DoExportImages()
             auto& image = images[j];
             if (params.rotate)
                 image.rotate(90);
-            params.images.push_back(Image32Bpp(image, params.names[i], filename, j, images.size() > 1));
+            params.images.push_back(Image32Bpp(image, params.names[i], filename, j, images.size() > 1, banded));
         }
     }
 
@@ -727,6 +808,9 @@ bool Nin10KitApp::DoExportImages()
     else if (params.device == "3DS")
         Do3DSExport(params.images, params.tileset_images, params.palette_images);
 
+    if (params.vram_plan)
+        ExportFile::PlanVram();
+
     InfoLog("Export complete now writing files");
     // Write the files
     std::ofstream file_c, file_h;
@@ -0,0 +1,73 @@
+#include <Magick++.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "cpercep.hpp"
+#include "export_params.hpp"
+#include "image16.hpp"
+#include "image32.hpp"
+#include "image8.hpp"
+#include "logger.hpp"
+#include "palette.hpp"
+
+ExportParams params;
+
+/** The 4x4 Bayer matrix as usually given */
+static const unsigned int bayer4[16] =
+{
+     0,  8,  2, 10,
+    12,  4, 14,  6,
+     3, 11,  1,  9,
+    15,  7, 13,  5,
+};
+
+int main(int argc, char** argv)
+{
+    Magick::InitializeMagick(*argv);
+    cpercep_init();
+    logger->SetLogLevel(LogLevel::WARNING);
+    params.transparent_color = Color(255, 0, 255);
+    params.dither = true;
+    params.dither_mode = "ordered";
+    params.dither_matrix = "bayer4";
+    params.dither_level = 1;
+    params.offset = 0;
+    int failures = 0;
+
+    // Index 0 is the transparent color, index v + 1 the gray of level v, so every perturbed gray is in the palette as is.
+    std::vector<Color16> colors = {Color16(params.transparent_color)};
+    for (unsigned char v = 0; v < 32; v++)
+        colors.push_back(Color16(v, v, v));
+    auto palette = std::make_shared<Palette>(colors, "test");
+
+    // At full dither level the offset at rank r is 2 * r - 15 levels, clamped to the 32 levels there are.
+    for (int level : {7, 15, 23})
+    {
+        char color[64];
+        snprintf(color, sizeof(color), "rgb(%d,%d,%d)", level * 8 + 4, level * 8 + 4, level * 8 + 4);
+        Magick::Image magick(Magick::Geometry(16, 8), Magick::Color(color));
+        Image32Bpp image32(magick, "gray", "gray", 0, false);
+        Image16Bpp image(image32);
+        Image8Bpp dithered(image, palette);
+
+        for (unsigned int y = 0; y < dithered.height; y++)
+        {
+            for (unsigned int x = 0; x < dithered.width; x++)
+            {
+                int rank = bayer4[(y % 4) * 4 + x % 4];
+                int expected = std::max(0, std::min(31, level + 2 * rank - 15)) + 1;
+                if (dithered.At(x, y) != expected)
+                {
+                    printf("gray %d: pixel (%d %d) is %d, expected %d\n", level, x, y, dithered.At(x, y), expected);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
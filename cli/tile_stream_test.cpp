@@ -0,0 +1,104 @@
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include "export_params.hpp"
+#include "logger.hpp"
+#include "tile-stream.hpp"
+
+ExportParams params;
+
+static unsigned int seed = 1;
+static unsigned int Random()
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7FFF;
+}
+
+/** Map of mostly distinct tiles with patches of open sky (tile 0) and a tile repeated all over */
+static std::vector<int> MakeMap(unsigned int width, unsigned int height)
+{
+    std::vector<int> tileIds(width * height);
+    int next = 2;
+    for (unsigned int i = 0; i < tileIds.size(); i++)
+    {
+        unsigned int r = Random() % 8;
+        tileIds[i] = r == 0 ? 0 : r == 1 ? 1 : r == 2 && i > 0 ? tileIds[i - 1] : next++;
+    }
+    return tileIds;
+}
+
+/** Checks that the entries in every window position use distinct slots unless they are the same tile, and that only
+  * the null tile uses slot 0. Gives the number of problems found. */
+static int CheckWindows(const TileStream& stream, const std::vector<int>& tileIds, unsigned int width, unsigned int height,
+                        unsigned int window_width, unsigned int window_height)
+{
+    int failures = 0;
+    for (unsigned int i = 0; i < tileIds.size(); i++)
+    {
+        if ((stream.slots[i] == 0) != (tileIds[i] == 0) || stream.slots[i] >= stream.num_slots)
+        {
+            printf("entry %d tile %d has slot %d\n", i, tileIds[i], stream.slots[i]);
+            failures++;
+        }
+    }
+
+    for (unsigned int y0 = 0; y0 + window_height <= height; y0++)
+    {
+        for (unsigned int x0 = 0; x0 + window_width <= width; x0++)
+        {
+            std::map<unsigned short, int> tile_of_slot;
+            for (unsigned int y = y0; y < y0 + window_height; y++)
+            {
+                for (unsigned int x = x0; x < x0 + window_width; x++)
+                {
+                    int tile = tileIds[y * width + x];
+                    unsigned short slot = stream.slots[y * width + x];
+                    if (!tile)
+                        continue;
+                    auto found = tile_of_slot.find(slot);
+                    if (found == tile_of_slot.end())
+                        tile_of_slot[slot] = tile;
+                    else if (found->second != tile)
+                    {
+                        printf("window at (%d %d) has tiles %d and %d in slot %d\n", x0, y0, found->second, tile, slot);
+                        return failures + 1;
+                    }
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+int main(int argc, char** argv)
+{
+    logger->SetLogLevel(LogLevel::WARNING);
+    params.force = false;
+    int failures = 0;
+
+    const unsigned int width = 96;
+    const unsigned int height = 48;
+    // GBA and DS screens plus the partly scrolled in column and row, and a window that isn't square to the cells.
+    const unsigned int windows[][2] = {{31, 21}, {33, 25}, {7, 13}};
+    for (unsigned int test = 0; test < 4; test++)
+    {
+        seed = test + 1;
+        std::vector<int> tileIds = MakeMap(width, height);
+        for (const auto& window : windows)
+        {
+            for (bool columns : {true, false})
+            {
+                TileStream stream("test", tileIds, width, height, columns, window[0], window[1]);
+                int found = CheckWindows(stream, tileIds, width, height, window[0], window[1]);
+                if (found)
+                    printf("test %d: %dx%d window %s major, %d problems\n", test, window[0], window[1], columns ? "column" : "row", found);
+                failures += found;
+            }
+        }
+    }
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -15,5 +15,9 @@ void LoggerWx::Log(LogLevel level, const char* format, va_list ap)
             throw "Fatal exception occured";
     }
     else
+    {
+        // Info lines can come from worker threads.
+        std::lock_guard<std::mutex> lock(log_mutex);
         (*out) << buffer << std::endl;
+    }
 }
@@ -15,6 +15,10 @@ void DefaultParams()
     params.palette_size = 256;
     params.border = 0;
     params.force = true;
+    params.flip_tiles = true;
+    params.pack_time_ms = 1000;
+    params.map_layout = "sbb";
+    params.tile_stream = "none";
 }
 
 ImageInfo::ImageInfo(const std::string& _filename) : filename(_filename)
@@ -242,13 +246,14 @@ void TransferToWx(const Map& map, wxImage& wx)
         {
             int x = i % map.width;
             int y = i / map.width;
-            int tile_id = map.data[i] & 0x3FF;
+            int tile_id = map.tileIds[i];
+            int flip = (map.data[i] >> 10) & 0x3;
             int pal_id = (map.data[i] >> 12) & 0xF;
             const Tile& tile = map.tileset->tilesExport[tile_id];
             const PaletteBank& palette = map.tileset->paletteBanks[pal_id];
             for (unsigned int j = 0; j < TILE_SIZE; j++)
             {
-                unsigned char pix = tile.pixels[j];
+                unsigned char pix = tile.pixels[FlippedIndex(j, flip)];
                 if (!pix) continue;
                 const auto& c = palette.At(pix);
                 wx.SetRGB(x * 8 + j % 8, y * 8 + j / 8, c.r << 3, c.g << 3, c.b << 3);
@@ -261,12 +266,13 @@ void TransferToWx(const Map& map, wxImage& wx)
         {
             int x = i % map.width;
             int y = i / map.width;
-            int tile_id = map.data[i] & 0x3FF;
+            int tile_id = map.tileIds[i];
+            int flip = (map.data[i] >> 10) & 0x3;
             const Tile& tile = map.tileset->tilesExport[tile_id];
             const Palette& palette = *map.tileset->palette;
             for (unsigned int j = 0; j < TILE_SIZE; j++)
             {
-                unsigned char pix = tile.pixels[j];
+                unsigned char pix = tile.pixels[FlippedIndex(j, flip)];
                 if (!pix) continue;
                 const auto& c = palette.At(pix);
                 wx.SetRGB(x * 8 + j % 8, y * 8 + j / 8, c.r << 3, c.g << 3, c.b << 3);
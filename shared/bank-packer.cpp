@@ -0,0 +1,533 @@
+#include "palette.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <random>
+
+#include "logger.hpp"
+#include "shared.hpp"
+
+#define BANK_COLORS 16
+// An extra color in a full bank costs more than any move can save in total colors.
+#define OVERFLOW_COST 32
+// Iterations per annealing cycle, the temperature falls from START_TEMPERATURE to END_TEMPERATURE over each.
+#define CYCLE_ITERATIONS 100000
+#define START_TEMPERATURE 8.0
+#define END_TEMPERATURE 0.05
+// Searches run with fixed seeds for a fixed number of iterations, so the packing found is the same on every run.
+#define PACK_SEARCHES 8
+#define SEARCH_ITERATIONS (20 * CYCLE_ITERATIONS)
+
+typedef std::chrono::steady_clock PackClock;
+
+/** The palettes left to place once identical palettes and palettes contained in another are dropped,
+  * colors are numbered from 0 to num_colors. */
+struct PackProblem
+{
+    unsigned int num_colors;
+    unsigned int num_banks;
+    /** Colors the banks held before packing, these stay where they are */
+    std::vector<std::vector<unsigned short>> fixed;
+    /** Banks holding the same lone color (the transparent color) or nothing, these can trade places */
+    std::vector<char> spare;
+    std::vector<std::vector<unsigned short>> groups;
+};
+
+/** One simulated annealing run moving groups between banks, lowering the colors banks have past 16
+  * and after that the colors used by all banks. */
+class BankSearch
+{
+    public:
+        BankSearch(const PackProblem& problem, const std::vector<int>& start, unsigned int seed);
+        /** Searches until no bank is over 16 colors, for at most max_iterations or until give_up returns true. True if it got there. */
+        bool Run(unsigned long max_iterations, const std::function<bool()>& give_up);
+        const std::vector<int>& Assignment() const {return assignment;}
+    private:
+        void Add(unsigned int group, int bank);
+        void Remove(unsigned int group);
+        long Energy(int bank) const {return OVERFLOW_COST * std::max(0, sizes[bank] - BANK_COLORS) + sizes[bank];}
+        const PackProblem& problem;
+        std::mt19937 rng;
+        std::vector<int> assignment;
+        /** Number of groups (plus fixed colors) using each color in each bank, num_colors counts per bank */
+        std::vector<unsigned short> counts;
+        std::vector<int> sizes;
+        std::vector<std::vector<unsigned int>> members;
+        /** Position of each group in members of its bank */
+        std::vector<unsigned int> slots;
+        int overflow;
+};
+
+BankSearch::BankSearch(const PackProblem& _problem, const std::vector<int>& start, unsigned int seed) : problem(_problem), rng(seed),
+    assignment(problem.groups.size(), -1), counts(problem.num_banks * problem.num_colors), sizes(problem.num_banks), members(problem.num_banks),
+    slots(problem.groups.size()), overflow(0)
+{
+    for (unsigned int i = 0; i < problem.num_banks; i++)
+    {
+        for (unsigned short color : problem.fixed[i])
+            counts[i * problem.num_colors + color]++;
+        sizes[i] = problem.fixed[i].size();
+    }
+
+    for (unsigned int i = 0; i < problem.groups.size(); i++)
+        if (start[i] != -1)
+            Add(i, start[i]);
+
+    // Palettes the greedy pass couldn't place go where they add the fewest colors.
+    for (unsigned int i = 0; i < problem.groups.size(); i++)
+    {
+        if (start[i] != -1)
+            continue;
+        int best = 0;
+        int min_added = 0x7FFFFFFF;
+        for (unsigned int j = 0; j < problem.num_banks; j++)
+        {
+            int added = 0;
+            for (unsigned short color : problem.groups[i])
+                added += counts[j * problem.num_colors + color] == 0;
+            if (added < min_added)
+            {
+                min_added = added;
+                best = j;
+            }
+        }
+        Add(i, best);
+    }
+}
+
+void BankSearch::Add(unsigned int group, int bank)
+{
+    overflow -= std::max(0, sizes[bank] - BANK_COLORS);
+    unsigned short* bank_counts = &counts[bank * problem.num_colors];
+    for (unsigned short color : problem.groups[group])
+        if (bank_counts[color]++ == 0)
+            sizes[bank]++;
+    overflow += std::max(0, sizes[bank] - BANK_COLORS);
+
+    assignment[group] = bank;
+    slots[group] = members[bank].size();
+    members[bank].push_back(group);
+}
+
+void BankSearch::Remove(unsigned int group)
+{
+    int bank = assignment[group];
+    overflow -= std::max(0, sizes[bank] - BANK_COLORS);
+    unsigned short* bank_counts = &counts[bank * problem.num_colors];
+    for (unsigned short color : problem.groups[group])
+        if (--bank_counts[color] == 0)
+            sizes[bank]--;
+    overflow += std::max(0, sizes[bank] - BANK_COLORS);
+
+    std::vector<unsigned int>& bank_members = members[bank];
+    unsigned int last = bank_members.back();
+    bank_members[slots[group]] = last;
+    slots[last] = slots[group];
+    bank_members.pop_back();
+    assignment[group] = -1;
+}
+
+bool BankSearch::Run(unsigned long max_iterations, const std::function<bool()>& give_up)
+{
+    double cooling = pow(END_TEMPERATURE / START_TEMPERATURE, 1.0 / CYCLE_ITERATIONS);
+    double temperature = START_TEMPERATURE;
+    std::vector<int> full;
+
+    for (unsigned long iteration = 0; overflow > 0; iteration++)
+    {
+        if (iteration == max_iterations || (iteration % 256 == 0 && give_up()))
+            return false;
+        if (iteration % CYCLE_ITERATIONS == 0)
+            temperature = START_TEMPERATURE;
+        temperature *= cooling;
+
+        // Only groups in banks over 16 colors are worth moving.
+        full.clear();
+        for (unsigned int i = 0; i < problem.num_banks; i++)
+            if (sizes[i] > BANK_COLORS && !members[i].empty())
+                full.push_back(i);
+        if (full.empty())
+            return false;
+
+        int from = full[rng() % full.size()];
+        int to = rng() % (problem.num_banks - 1);
+        if (to >= from)
+            to++;
+        unsigned int group = members[from][rng() % members[from].size()];
+        // Half the time swap with a group from the other bank so full banks can trade.
+        int other = (!members[to].empty() && rng() % 2) ? members[to][rng() % members[to].size()] : -1;
+
+        long before = Energy(from) + Energy(to);
+        Remove(group);
+        if (other != -1)
+        {
+            Remove(other);
+            Add(other, from);
+        }
+        Add(group, to);
+        long delta = Energy(from) + Energy(to) - before;
+
+        // mt19937 output is fixed by the standard, unlike that of the distributions.
+        if (delta <= 0 || rng() / 4294967296.0 < exp(-delta / temperature))
+            continue;
+
+        Remove(group);
+        if (other != -1)
+        {
+            Remove(other);
+            Add(other, to);
+        }
+        Add(group, from);
+    }
+
+    return true;
+}
+
+/** The assignment Tileset::Init4bpp has always made, palettes taking the last bank containing them or the bank
+  * they add the fewest colors to. Returns false if some palette (bank -1) fit nowhere. */
+static bool GreedyPack(const std::vector<std::vector<unsigned short>>& entries, const PackProblem& problem, std::vector<int>& bank)
+{
+    std::vector<char> used(problem.num_banks * problem.num_colors, 0);
+    std::vector<int> sizes(problem.num_banks);
+    for (unsigned int i = 0; i < problem.num_banks; i++)
+    {
+        for (unsigned short color : problem.fixed[i])
+            used[i * problem.num_colors + color] = 1;
+        sizes[i] = problem.fixed[i].size();
+    }
+
+    bool packed = true;
+    bank.assign(entries.size(), -1);
+    for (unsigned int i = 0; i < entries.size(); i++)
+    {
+        int pbank = -1;
+        int min_delta = 0x7FFFFFFF;
+        for (unsigned int j = 0; j < problem.num_banks; j++)
+        {
+            // Every entry counts as in PaletteBank::CanMerge.
+            int missing = 0;
+            for (unsigned short color : entries[i])
+                missing += !used[j * problem.num_colors + color];
+            if (missing == 0)
+                bank[i] = j;
+            if (sizes[j] + missing <= BANK_COLORS && missing < min_delta)
+            {
+                min_delta = missing;
+                pbank = j;
+            }
+        }
+
+        if (bank[i] != -1)
+            continue;
+        if (pbank == -1)
+        {
+            packed = false;
+            continue;
+        }
+
+        bank[i] = pbank;
+        for (unsigned short color : entries[i])
+        {
+            char& in_bank = used[pbank * problem.num_colors + color];
+            sizes[pbank] += !in_bank;
+            in_bank = 1;
+        }
+    }
+
+    return packed;
+}
+
+/** Drops the palettes identical to or contained in another, group[i] is the group holding palettes[i] (or a superset of it). */
+static void GroupPalettes(const std::vector<std::vector<unsigned short>>& palettes, PackProblem& problem, std::vector<int>& group)
+{
+    std::vector<unsigned int> order(palettes.size());
+    for (unsigned int i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {return palettes[a].size() > palettes[b].size();});
+
+    unsigned int words = (problem.num_colors + 63) / 64;
+    std::vector<uint64_t> bits;
+    group.assign(palettes.size(), -1);
+    for (unsigned int i : order)
+    {
+        std::vector<uint64_t> palette_bits(words, 0);
+        for (unsigned short color : palettes[i])
+            palette_bits[color / 64] |= 1ULL << (color % 64);
+
+        for (unsigned int j = 0; j < problem.groups.size() && group[i] == -1; j++)
+        {
+            const uint64_t* group_bits = &bits[j * words];
+            bool contained = true;
+            for (unsigned int k = 0; k < words && contained; k++)
+                contained = (palette_bits[k] & ~group_bits[k]) == 0;
+            if (contained)
+                group[i] = j;
+        }
+
+        if (group[i] == -1)
+        {
+            group[i] = problem.groups.size();
+            problem.groups.push_back(palettes[i]);
+            bits.insert(bits.end(), palette_bits.begin(), palette_bits.end());
+        }
+    }
+}
+
+/** Merges the two clusters of groups sharing the most colors that fit a bank together until the clusters fit the banks,
+  * banks holding colors that aren't spare are clusters that can't merge with each other. Each merge leaves one cluster less,
+  * so this ends after at most as many merges as there are groups. start[i] is the bank of group i, -1 for the clusters left over once the banks run out. */
+static void MergeGroups(const PackProblem& problem, std::vector<int>& start)
+{
+    unsigned int words = (problem.num_colors + 63) / 64;
+    // The first num_banks clusters are the banks' fixed colors.
+    unsigned int num_clusters = problem.num_banks + problem.groups.size();
+    std::vector<uint64_t> bits(num_clusters * words, 0);
+    std::vector<int> sizes(num_clusters, 0);
+    std::vector<int> cluster(problem.groups.size());
+    std::vector<char> alive(num_clusters, 0);
+    unsigned int num_alive = 0;
+    auto add = [&](unsigned int c, const std::vector<unsigned short>& colors)
+    {
+        for (unsigned short color : colors)
+            bits[c * words + color / 64] |= 1ULL << (color % 64);
+        sizes[c] = colors.size();
+        alive[c] = 1;
+        num_alive++;
+    };
+    for (unsigned int i = 0; i < problem.num_banks; i++)
+        if (!problem.spare[i] && !problem.fixed[i].empty())
+            add(i, problem.fixed[i]);
+    for (unsigned int i = 0; i < problem.groups.size(); i++)
+    {
+        add(problem.num_banks + i, problem.groups[i]);
+        cluster[i] = problem.num_banks + i;
+    }
+
+    // Colors every group has (the transparent color) say nothing about which groups belong together.
+    std::vector<uint64_t> common(words, ~0ULL);
+    for (unsigned int i = 0; i < problem.groups.size(); i++)
+        for (unsigned int k = 0; k < words; k++)
+            common[k] &= bits[(problem.num_banks + i) * words + k];
+
+    // Merge score of two clusters, colors shared then fewest colors together, -1 if they can't merge.
+    auto score = [&](unsigned int a, unsigned int b)
+    {
+        if (a == b || !alive[a] || !alive[b] || (a < problem.num_banks && b < problem.num_banks))
+            return -1;
+        int shared = 0;
+        int shared_common = 0;
+        for (unsigned int k = 0; k < words; k++)
+        {
+            uint64_t both = bits[a * words + k] & bits[b * words + k];
+            shared += std::bitset<64>(both & ~common[k]).count();
+            shared_common += std::bitset<64>(both & common[k]).count();
+        }
+        int merged = sizes[a] + sizes[b] - shared - shared_common;
+        return merged > BANK_COLORS ? -1 : shared * 64 - merged;
+    };
+    std::vector<int> best_score(num_clusters, -1);
+    std::vector<unsigned int> best(num_clusters, 0);
+    auto find_best = [&](unsigned int a)
+    {
+        best_score[a] = -1;
+        for (unsigned int b = 0; b < num_clusters; b++)
+        {
+            int s = score(a, b);
+            if (s > best_score[a])
+            {
+                best_score[a] = s;
+                best[a] = b;
+            }
+        }
+    };
+    for (unsigned int i = 0; i < num_clusters; i++)
+        if (alive[i])
+            find_best(i);
+
+    while (num_alive > problem.num_banks)
+    {
+        unsigned int a = std::max_element(best_score.begin(), best_score.end()) - best_score.begin();
+        if (best_score[a] < 0)
+            break;
+        unsigned int b = best[a];
+        // Keep the bank if one of them is a bank.
+        if (b < a)
+            std::swap(a, b);
+        for (unsigned int k = 0; k < words; k++)
+            bits[a * words + k] |= bits[b * words + k];
+        sizes[a] = 0;
+        for (unsigned int k = 0; k < words; k++)
+            sizes[a] += std::bitset<64>(bits[a * words + k]).count();
+        alive[b] = 0;
+        best_score[b] = -1;
+        num_alive--;
+        for (auto& c : cluster)
+            if (c == (int)b)
+                c = a;
+
+        // Only pairs with a or b changed.
+        find_best(a);
+        for (unsigned int i = 0; i < num_clusters; i++)
+        {
+            if (!alive[i] || i == a)
+                continue;
+            if (best[i] == a || best[i] == b)
+                find_best(i);
+            else if (score(i, a) > best_score[i])
+            {
+                best_score[i] = score(i, a);
+                best[i] = a;
+            }
+        }
+    }
+
+    // Clusters holding fixed colors keep their bank, the rest take the spare and empty banks in order.
+    std::vector<int> bank(num_clusters, -1);
+    unsigned int next_bank = 0;
+    for (unsigned int i = 0; i < num_clusters; i++)
+    {
+        if (!alive[i])
+            continue;
+        if (i < problem.num_banks)
+        {
+            bank[i] = i;
+            continue;
+        }
+        while (next_bank < problem.num_banks && !problem.spare[next_bank] && !problem.fixed[next_bank].empty())
+            next_bank++;
+        if (next_bank < problem.num_banks)
+            bank[i] = next_bank++;
+    }
+
+    start.resize(problem.groups.size());
+    for (unsigned int i = 0; i < problem.groups.size(); i++)
+        start[i] = bank[cluster[i]];
+}
+
+bool PackPaletteBanks(const std::vector<std::vector<Color16>>& palettes, const PaletteBankManager& banks, unsigned int time_ms, std::vector<int>& bank)
+{
+    // Number every color seen.
+    ColorSet all;
+    for (const auto& palette : palettes)
+        for (const auto& color : palette)
+            all.Insert(color);
+    for (unsigned int i = 0; i < banks.Size(); i++)
+        for (const auto& color : banks[i].GetColors())
+            all.Insert(color);
+    const std::vector<unsigned short>& keys = all.Keys();
+    auto number = [&](const std::vector<Color16>& colors, bool distinct)
+    {
+        std::vector<unsigned short> ids;
+        for (const auto& color : colors)
+            ids.push_back(std::lower_bound(keys.begin(), keys.end(), color.ToIndex()) - keys.begin());
+        if (distinct)
+        {
+            std::sort(ids.begin(), ids.end());
+            ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        }
+        return ids;
+    };
+
+    PackProblem problem;
+    problem.num_colors = keys.size();
+    problem.num_banks = banks.Size();
+    for (unsigned int i = 0; i < banks.Size(); i++)
+        problem.fixed.push_back(number(banks[i].GetColors(), true));
+    for (unsigned int i = 0; i < banks.Size(); i++)
+        problem.spare.push_back(problem.fixed[i].size() <= 1 && problem.fixed[i] == problem.fixed.back());
+
+    std::vector<std::vector<unsigned short>> entries;
+    entries.reserve(palettes.size());
+    for (const auto& palette : palettes)
+        entries.push_back(number(palette, false));
+
+    std::vector<int> greedy;
+    if (GreedyPack(entries, problem, greedy))
+    {
+        bank.swap(greedy);
+        return true;
+    }
+
+    bank.assign(palettes.size(), -1);
+    int unplaced = std::count(greedy.begin(), greedy.end(), -1);
+    if (time_ms == 0 || problem.num_banks < 2 || problem.num_colors > problem.num_banks * BANK_COLORS)
+        return false;
+
+    VerboseLog("%d palettes didn't fit any palette bank, searching for up to %d ms", unplaced, time_ms);
+    PackClock::time_point begin = PackClock::now();
+
+    std::vector<std::vector<unsigned short>> distinct;
+    distinct.reserve(entries.size());
+    for (const auto& palette : palettes)
+        distinct.push_back(number(palette, true));
+    std::vector<int> group;
+    GroupPalettes(distinct, problem, group);
+
+    // Searches start from clusters of palettes sharing colors.
+    PackClock::time_point deadline = begin + std::chrono::milliseconds(time_ms);
+    std::vector<int> start;
+    MergeGroups(problem, start);
+
+    // Independent searches, the lowest numbered one to find a packing wins. A search only gives up early once a lower
+    // numbered search found one, so which one wins doesn't depend on timing unless the deadline is hit.
+    std::atomic<unsigned int> first(PACK_SEARCHES);
+    std::atomic<bool> timed_out(false);
+    std::vector<std::vector<int>> results(PACK_SEARCHES);
+    ParallelFor(PACK_SEARCHES, [&](unsigned int i)
+    {
+        BankSearch search(problem, start, i);
+        auto give_up = [&]()
+        {
+            if (first < i)
+                return true;
+            if (PackClock::now() < deadline)
+                return false;
+            timed_out = true;
+            return true;
+        };
+        if (search.Run(SEARCH_ITERATIONS, give_up))
+        {
+            results[i] = search.Assignment();
+            unsigned int current = first;
+            while (i < current && !first.compare_exchange_weak(current, i)) {}
+        }
+    });
+
+    long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(PackClock::now() - begin).count();
+    if (timed_out)
+        WarnLog("Palette bank search stopped at --pack_time_ms after %ld ms, the palette banks found may differ between runs. "
+                "Raise --pack_time_ms to get the same palette banks every run.", elapsed);
+    if (first == PACK_SEARCHES)
+    {
+        VerboseLog("No palette bank packing found after %ld ms", elapsed);
+        return false;
+    }
+    const std::vector<int>& assignment = results[first];
+
+    // Spare banks left unused go last, PaletteBankManager only exports banks up to the first unused one.
+    std::vector<int> renumber(problem.num_banks);
+    std::vector<char> filled(problem.num_banks, 0);
+    for (int group_bank : assignment)
+        filled[group_bank] = 1;
+    std::vector<unsigned int> spare_banks;
+    for (unsigned int i = 0; i < problem.num_banks; i++)
+    {
+        renumber[i] = i;
+        if (problem.spare[i])
+            spare_banks.push_back(i);
+    }
+    std::vector<unsigned int> sorted_banks = spare_banks;
+    std::stable_sort(sorted_banks.begin(), sorted_banks.end(), [&](unsigned int a, unsigned int b) {return filled[a] > filled[b];});
+    for (unsigned int i = 0; i < spare_banks.size(); i++)
+        renumber[sorted_banks[i]] = spare_banks[i];
+
+    for (unsigned int i = 0; i < palettes.size(); i++)
+        bank[i] = renumber[assignment[group[i]]];
+
+    InfoLog("Found a palette bank for %d more palettes after %ld ms", unplaced, elapsed);
+    return true;
+}
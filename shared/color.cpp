@@ -1,4 +1,9 @@
 #include "color.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <vector>
+
 #include "cpercep.hpp"
 #include "logger.hpp"
 
@@ -44,6 +49,24 @@ void lin_to_rgb(const double hr, const double hg, const double hb, unsigned char
     *b = (int)CLAMP(rgb[2] * 255, 0.0F, 255.0F);
 }
 
+/** Every 15 bit color converted to LAB once, indexed by Color16::ToIndex. */
+static const std::vector<ColorLAB>& Color16LabTable()
+{
+    static const std::vector<ColorLAB> table = []()
+    {
+        // Table may be requested before main gets around to it.
+        cpercep_init();
+        std::vector<ColorLAB> lab(COLOR16_COUNT);
+        for (unsigned int i = 0; i < COLOR16_COUNT; i++)
+        {
+            ColorLAB& color = lab[i];
+            rgb_to_lin((i & 0x1F) << 3, (i >> 5 & 0x1F) << 3, (i >> 10 & 0x1F) << 3, &color.l, &color.a, &color.b);
+        }
+        return lab;
+    }();
+    return table;
+}
+
 static inline bool GenericComponentCompare(int a1, int b1, int c1, int a2, int b2, int c2)
 {
     if (a1 != a2)
@@ -106,7 +129,7 @@ ColorLAB::ColorLAB(const Color& color)
 
 ColorLAB::ColorLAB(const Color16& color)
 {
-    rgb_to_lin(color.r << 3, color.g << 3, color.b << 3, &l, &a, &b);
+    *this = Color16LabTable()[color.ToIndex()];
 }
 
 bool ColorLAB::operator<(const ColorLAB& color) const
@@ -123,3 +146,56 @@ unsigned long ColorLAB::Distance(const ColorLAB& color) const
 {
     return GenericComponentDistance(l, a, b, color.l, color.a, color.b);
 }
+
+#define COLORSET_WORDS (COLOR16_COUNT / 64)
+
+bool ColorSet::Insert(const Color16& color)
+{
+    if (Contains(color))
+        return false;
+    if (bits.empty())
+        bits.resize(COLORSET_WORDS);
+
+    unsigned short key = color.ToIndex();
+    bits[key >> 6] |= 1ULL << (key & 63);
+    keys.insert(std::lower_bound(keys.begin(), keys.end(), key), key);
+    return true;
+}
+
+void ColorSet::Erase(const Color16& color)
+{
+    if (!Contains(color))
+        return;
+
+    unsigned short key = color.ToIndex();
+    bits[key >> 6] &= ~(1ULL << (key & 63));
+    keys.erase(std::lower_bound(keys.begin(), keys.end(), key));
+}
+
+void ColorSet::Clear()
+{
+    // Only touch the words in use, small sets are cleared far more often than they are big.
+    for (unsigned short key : keys)
+        bits[key >> 6] = 0;
+    keys.clear();
+}
+
+unsigned int ColorSet::CountMissing(const ColorSet& other) const
+{
+    if (bits.empty())
+        return other.Size();
+
+    // Few colors are cheaper to look up one by one than ANDing every word.
+    if (other.keys.size() * 8 < COLORSET_WORDS)
+    {
+        unsigned int missing = 0;
+        for (unsigned short key : other.keys)
+            missing += !(bits[key >> 6] >> (key & 63) & 1);
+        return missing;
+    }
+
+    unsigned int missing = 0;
+    for (unsigned int i = 0; i < COLORSET_WORDS; i++)
+        missing += std::bitset<64>(other.bits[i] & ~bits[i]).count();
+    return missing;
+}
@@ -1,6 +1,11 @@
 #ifndef COLOR_HPP
 #define COLOR_HPP
 
+#include <cstdint>
+#include <vector>
+
+#define COLOR16_COUNT 32768
+
 class ColorLAB;
 
 /** Normal everyday 8 bpp color with alpha */
@@ -32,11 +37,37 @@ class Color16
         unsigned short ToGBAShort() const {return r | (g << 5) | (b << 10);}
         unsigned short ToDSShort() const {return r | (g << 5) | (b << 10) | (a << 15);}
         Color ToColor() const {return Color(r << 3, g << 3, b << 3, a * 255);}
+        /** Packs r, g, b into [0, COLOR16_COUNT) for tables indexed by color */
+        unsigned short ToIndex() const {return (r & 0x1F) | (g & 0x1F) << 5 | (b & 0x1F) << 10;}
         /** Color components range 0-31 */
         bool a;
         unsigned char r, g, b;
 };
 
+/** Set of Color16 compared like Color16::operator==. Keeps the packed colors sorted plus a
+  * COLOR16_COUNT bit membership bitset, allocated with the first color, for constant time lookups. */
+class ColorSet
+{
+    public:
+        /** Adds color, returns false if it was already in the set */
+        bool Insert(const Color16& color);
+        void Erase(const Color16& color);
+        void Clear();
+        bool Contains(const Color16& color) const
+        {
+            unsigned short key = color.ToIndex();
+            return !bits.empty() && (bits[key >> 6] >> (key & 63) & 1);
+        }
+        /** Number of colors of other not in this set */
+        unsigned int CountMissing(const ColorSet& other) const;
+        unsigned int Size() const {return keys.size();}
+        /** Color16::ToIndex of each color in increasing order */
+        const std::vector<unsigned short>& Keys() const {return keys;}
+    private:
+        std::vector<unsigned short> keys;
+        std::vector<uint64_t> bits;
+};
+
 /** Color in the LAB colorspace */
 class ColorLAB
 {
@@ -1,158 +1,145 @@
 #include "dither.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include "logger.hpp"
+#include "shared.hpp"
 
 #ifndef CLAMP
 #define CLAMP(x) (((x) < 0.0) ? 0.0 : (((x) > 31) ? 31 : (x)))
 #endif
 
+/* Diffused error is kept in fixed point, 1 color component level = ERROR_ONE */
+#define ERROR_ONE 256
+/* Farthest a kernel diffuses error to the right on the same row */
+#define KERNEL_MAX_DX 2
+
 struct DitherImage
 {
     DitherImage(const Image16Bpp& _inImage, Image8Bpp& _outImage, const Color16& _transparent, int _dither, float _ditherlevel) :
-        inImage(_inImage), outImage(_outImage), transparent(_transparent), x(0), y(0), dither(_dither), ditherlevel(_ditherlevel) {};
+        inImage(_inImage), outImage(_outImage), transparent(_transparent), dither(_dither), ditherlevel(_ditherlevel),
+        ex(0), ey(0), ez(0) {};
     const Image16Bpp& inImage;
     Image8Bpp& outImage;
     Color transparent;
-    unsigned int x, y;
     int dither;
     float ditherlevel;
+    /** Error carried along the curve, per image so images can be dithered concurrently */
+    int ex, ey, ez;
 };
 
-enum
+/** Part of the curve left to walk, the rectangle at x, y spanned by major axis (ax, ay) and minor axis (bx, by) */
+struct GilbertRect
 {
-    NONE,
-    UP,
-    LEFT,
-    DOWN,
-    RIGHT,
+    GilbertRect(int _x, int _y, int _ax, int _ay, int _bx, int _by) : x(_x), y(_y), ax(_ax), ay(_ay), bx(_bx), by(_by) {}
+    int x, y;
+    int ax, ay;
+    int bx, by;
 };
 
-int Dither(const Color16& color, std::shared_ptr<Palette>& palette, const Color16& transparent, int dither, float ditherlevel)
+static inline int sign(int x)
+{
+    return (x > 0) - (x < 0);
+}
+
+static inline int half(int x)
 {
-    static int ex = 0, ey = 0, ez = 0;
-    if (color == transparent) return 0;
+    // Rounds towards -infinity, axes pointing left or up are negative.
+    return x >= 0 ? x / 2 : -((1 - x) / 2);
+}
+
+static int Dither(DitherImage& dither, const Color16& color)
+{
+    if (color == dither.transparent) return 0;
+
+    const Palette& palette = *dither.outImage.palette;
+    int& ex = dither.ex;
+    int& ey = dither.ey;
+    int& ez = dither.ez;
 
     Color16 newColor(CLAMP(color.r + ex), CLAMP(color.g + ey), CLAMP(color.b + ez));
-    int index = palette->Search(newColor);
-    newColor = palette->At(index);
+    int index = palette.Search(newColor);
+    newColor = palette.At(index);
 
-    if (dither)
+    if (dither.dither)
     {
         ex += (color.r - newColor.r);
         ey += (color.g - newColor.g);
         ez += (color.b - newColor.b);
-        ex = std::max(std::min(31, ex), -31) * ditherlevel;
-        ey = std::max(std::min(31, ey), -31) * ditherlevel;
-        ez = std::max(std::min(31, ez), -31) * ditherlevel;
+        ex = std::max(std::min(31, ex), -31) * dither.ditherlevel;
+        ey = std::max(std::min(31, ey), -31) * dither.ditherlevel;
+        ez = std::max(std::min(31, ez), -31) * dither.ditherlevel;
     }
 
     return index;
 }
 
-static void move(DitherImage& dither, int direction)
+/** Calls visit(x, y) once for each pixel of a width x height rectangle in generalized Hilbert curve order.
+  * From https://github.com/jakubcerveny/gilbert with the recursion replaced by a stack. */
+template <typename Visitor>
+static void Gilbert(int width, int height, Visitor visit)
 {
-    const Image16Bpp& image = dither.inImage;
-    Image8Bpp& indexedImage = dither.outImage;
-    int x = dither.x;
-    int y = dither.y;
-    int width = indexedImage.width;
-    int height = indexedImage.height;
-    /* dither the current pixel */
-    if (x >= 0 && x < width && y >= 0 && y < height)
-    {
-        int index = Dither(image.pixels[x + y * width], dither.outImage.palette, dither.transparent, dither.dither, dither.ditherlevel);
-        indexedImage.pixels[x + y * width] = index;
-    }
+    std::vector<GilbertRect> stack;
+    if (width >= height)
+        stack.emplace_back(0, 0, width, 0, 0, height);
+    else
+        stack.emplace_back(0, 0, 0, height, width, 0);
 
-    /* move to the next pixel */
-    switch (direction)
+    while (!stack.empty())
     {
-        case LEFT:
-            dither.x -= 1;
-            break;
-        case RIGHT:
-            dither.x += 1;
-            break;
-        case UP:
-            dither.y -= 1;
-            break;
-        case DOWN:
-            dither.y += 1;
-            break;
-    }
-}
+        GilbertRect r = stack.back();
+        stack.pop_back();
 
-void Hilbert(DitherImage& dither, int level, int direction)
-{
-    if (level == 1)
-    {
-        switch (direction)
+        int w = std::abs(r.ax + r.ay);
+        int h = std::abs(r.bx + r.by);
+        int dax = sign(r.ax), day = sign(r.ay);
+        int dbx = sign(r.bx), dby = sign(r.by);
+
+        if (h == 1 || w == 1)
         {
-            case LEFT:
-                move(dither, RIGHT);
-                move(dither, DOWN);
-                move(dither, LEFT);
-                break;
-            case RIGHT:
-                move(dither, LEFT);
-                move(dither, UP);
-                move(dither, RIGHT);
-                break;
-            case UP:
-                move(dither, DOWN);
-                move(dither, RIGHT);
-                move(dither, UP);
-                break;
-            case DOWN:
-                move(dither, UP);
-                move(dither, LEFT);
-                move(dither, DOWN);
-                break;
+            // A single row or column is walked straight through.
+            int dx = h == 1 ? dax : dbx;
+            int dy = h == 1 ? day : dby;
+            int x = r.x, y = r.y;
+            for (int i = 0; i < std::max(w, h); i++, x += dx, y += dy)
+                visit(x, y);
+            continue;
         }
-    }
-    else
-    {
-        switch (direction)
+
+        int ax2 = half(r.ax), ay2 = half(r.ay);
+        int bx2 = half(r.bx), by2 = half(r.by);
+        int w2 = std::abs(ax2 + ay2);
+        int h2 = std::abs(bx2 + by2);
+
+        // Subrectangles are pushed last first.
+        if (2 * w > 3 * h)
+        {
+            // Long rectangle, split in two along the major axis keeping the halves even.
+            if ((w2 & 1) && w > 2)
+            {
+                ax2 += dax;
+                ay2 += day;
+            }
+            stack.emplace_back(r.x + ax2, r.y + ay2, r.ax - ax2, r.ay - ay2, r.bx, r.by);
+            stack.emplace_back(r.x, r.y, ax2, ay2, r.bx, r.by);
+        }
+        else
         {
-            case LEFT:
-                Hilbert(dither, level - 1, UP);
-                move(dither, RIGHT);
-                Hilbert(dither, level - 1, LEFT);
-                move(dither, DOWN);
-                Hilbert(dither, level - 1, LEFT);
-                move(dither, LEFT);
-                Hilbert(dither, level - 1, DOWN);
-                break;
-            case RIGHT:
-                Hilbert(dither, level - 1, DOWN);
-                move(dither, LEFT);
-                Hilbert(dither, level - 1, RIGHT);
-                move(dither, UP);
-                Hilbert(dither, level - 1, RIGHT);
-                move(dither, RIGHT);
-                Hilbert(dither, level - 1, UP);
-                break;
-            case UP:
-                Hilbert(dither, level - 1, LEFT);
-                move(dither, DOWN);
-                Hilbert(dither, level - 1, UP);
-                move(dither, RIGHT);
-                Hilbert(dither, level - 1, UP);
-                move(dither, UP);
-                Hilbert(dither, level - 1, RIGHT);
-                break;
-            case DOWN:
-                Hilbert(dither, level - 1, RIGHT);
-                move(dither, UP);
-                Hilbert(dither, level - 1, DOWN);
-                move(dither, LEFT);
-                Hilbert(dither, level - 1, DOWN);
-                move(dither, DOWN);
-                Hilbert(dither, level - 1, LEFT);
-                break;
+            // Standard case, up along the minor axis, across, then back down.
+            if ((h2 & 1) && h > 2)
+            {
+                bx2 += dbx;
+                by2 += dby;
+            }
+            stack.emplace_back(r.x + (r.ax - dax) + (bx2 - dbx), r.y + (r.ay - day) + (by2 - dby), -bx2, -by2, -(r.ax - ax2), -(r.ay - ay2));
+            stack.emplace_back(r.x + bx2, r.y + by2, r.ax, r.ay, r.bx - bx2, r.by - by2);
+            stack.emplace_back(r.x, r.y, bx2, by2, ax2, ay2);
         }
     }
 }
@@ -160,7 +147,127 @@ void Hilbert(DitherImage& dither, int level, int direction)
 void RiemersmaDither(const Image16Bpp& inImage, Image8Bpp& outImage, const Color16& transparent, int dither, float ditherlevel)
 {
     DitherImage dimage(inImage, outImage, transparent, dither, ditherlevel);
-    int size = ceil(log2(std::max(inImage.width, inImage.height)));
-    if (size > 0) Hilbert(dimage, size, UP);
-    move(dimage, NONE);
+    int width = inImage.width;
+    if (width <= 0 || inImage.height <= 0) return;
+    Gilbert(width, inImage.height, [&](int x, int y)
+    {
+        outImage.pixels[x + y * width] = Dither(dimage, inImage.pixels[x + y * width]);
+    });
+}
+
+struct DiffusionWeight
+{
+    int dx, dy, weight;
+};
+
+struct DiffusionKernel
+{
+    const char* name;
+    int divisor;
+    std::vector<DiffusionWeight> weights;
+};
+
+static const DiffusionKernel& GetDiffusionKernel(const std::string& name)
+{
+    static const std::vector<DiffusionKernel> kernels =
+    {
+        {"floydsteinberg", 16, {{1, 0, 7}, {-1, 1, 3}, {0, 1, 5}, {1, 1, 1}}},
+        // Only diffuses 6/8 of the error.
+        {"atkinson", 8, {{1, 0, 1}, {2, 0, 1}, {-1, 1, 1}, {0, 1, 1}, {1, 1, 1}, {0, 2, 1}}},
+        {"sierralite", 4, {{1, 0, 2}, {-1, 1, 1}, {0, 1, 1}}},
+    };
+
+    for (const auto& kernel : kernels)
+    {
+        if (name == kernel.name)
+            return kernel;
+    }
+
+    FatalLog("Unknown error diffusion kernel %s. Valid kernels are [floydsteinberg, atkinson, sierralite].", name.c_str());
+    return kernels[0];
+}
+
+void ErrorDiffusionDither(const Image16Bpp& inImage, Image8Bpp& outImage, const Color16& transparent, const std::string& kernel_name, float ditherlevel)
+{
+    const DiffusionKernel& kernel = GetDiffusionKernel(kernel_name);
+    const int width = inImage.width;
+    const int height = inImage.height;
+    if (width <= 0 || height <= 0) return;
+
+    const Palette& palette = *outImage.palette;
+    // Rows are dithered by several threads at once.
+    if (height > 1)
+        palette.FillColormap();
+
+    // A row may start pixel x once the row above has finished every pixel that diffuses into x.
+    int lag = 1;
+    for (const auto& weight : kernel.weights)
+    {
+        if (weight.dy > 0)
+            lag = std::max(lag, 1 - weight.dx);
+    }
+
+    // Error diffused to later rows, integers so the order contributions arrive in doesn't matter.
+    std::vector<int> errors(width * height * 3);
+    std::unique_ptr<std::atomic<int>[]> progress(new std::atomic<int>[height]);
+    for (int y = 0; y < height; y++)
+        progress[y] = 0;
+
+    const int strength = (int)round(ditherlevel * ERROR_ONE);
+    ParallelFor(height, [&](unsigned int row)
+    {
+        const int y = row;
+        // Error diffused along this row never leaves this thread.
+        std::vector<int> carry((width + KERNEL_MAX_DX) * 3);
+        int ready = y == 0 ? width : 0;
+        for (int x = 0; x < width; x++)
+        {
+            const int needed = std::min(width, x + lag);
+            while (ready < needed)
+            {
+                ready = progress[y - 1].load(std::memory_order_acquire);
+                if (ready < needed)
+                    std::this_thread::yield();
+            }
+
+            const Color16& color = inImage.pixels[y * width + x];
+            if (color == transparent)
+            {
+                outImage.pixels[y * width + x] = 0;
+                progress[y].store(x + 1, std::memory_order_release);
+                continue;
+            }
+
+            int* error = &errors[(y * width + x) * 3];
+            int* carried = &carry[x * 3];
+            int value[3] = {color.r * ERROR_ONE + error[0] + carried[0],
+                            color.g * ERROR_ONE + error[1] + carried[1],
+                            color.b * ERROR_ONE + error[2] + carried[2]};
+            for (int i = 0; i < 3; i++)
+                value[i] = std::max(0, std::min(31 * ERROR_ONE, value[i]));
+
+            Color16 target((value[0] + ERROR_ONE / 2) / ERROR_ONE, (value[1] + ERROR_ONE / 2) / ERROR_ONE, (value[2] + ERROR_ONE / 2) / ERROR_ONE);
+            int index = palette.Search(target);
+            outImage.pixels[y * width + x] = index;
+
+            const Color16& chosen = palette.At(index);
+            int diff[3] = {(value[0] - chosen.r * ERROR_ONE) * strength / ERROR_ONE,
+                           (value[1] - chosen.g * ERROR_ONE) * strength / ERROR_ONE,
+                           (value[2] - chosen.b * ERROR_ONE) * strength / ERROR_ONE};
+
+            for (const auto& weight : kernel.weights)
+            {
+                int nx = x + weight.dx;
+                int ny = y + weight.dy;
+                if (nx < 0 || nx >= width || ny >= height)
+                    continue;
+
+                int* target_error = weight.dy == 0 ? &carry[nx * 3] : &errors[(ny * width + nx) * 3];
+                for (int i = 0; i < 3; i++)
+                    target_error[i] += diff[i] * weight.weight / kernel.divisor;
+            }
+
+            progress[y].store(x + 1, std::memory_order_release);
+        }
+    });
 }
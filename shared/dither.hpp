@@ -1,11 +1,23 @@
 #ifndef DITHER_HPP
 #define DITHER_HPP
 
+#include <string>
+
 #include "color.hpp"
 #include "image16.hpp"
 #include "image8.hpp"
 
 // Implements algorithm from http://www.compuphase.com/riemer.htm
+// walking a generalized Hilbert curve that fits the image exactly instead of a power of 2 square.
+// Safe to call on several images at once as long as the palette they share had FillColormap called.
 void RiemersmaDither(const Image16Bpp& inImage, Image8Bpp& outimage, const Color16& transparent, int dither, float ditherlevel);
 
+// Error diffusion with a Floyd-Steinberg, Atkinson or Sierra Lite kernel (floydsteinberg, atkinson, sierralite).
+// Every row runs left to right so that rows can be dithered in parallel, each trailing the row above by a few pixels.
+void ErrorDiffusionDither(const Image16Bpp& inImage, Image8Bpp& outImage, const Color16& transparent, const std::string& kernel, float ditherlevel);
+
+// Ordered dithering with a threshold matrix (bayer4, bayer8, bluenoise), each pixel only depends on its own position.
+// Implemented in ordered-dither.cpp
+void OrderedDither(const Image16Bpp& inImage, Image8Bpp& outImage, const Color16& transparent, const std::string& matrix, float ditherlevel);
+
 #endif
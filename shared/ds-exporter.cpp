@@ -14,13 +14,19 @@ void DoMode4Export(const std::vector<Image16Bpp>& images, const std::shared_ptr<
 void DoPaletteExport(const std::vector<Image16Bpp>& images);
 void DoTilesetExport(const std::vector<Image16Bpp>& images, const std::shared_ptr<Palette>& palette);
 void DoMapExport(const std::vector<Image16Bpp>& images, const std::vector<Image16Bpp>& tilesets);
+void DoWorldMapExport(const std::vector<Image32Bpp>& images, const std::vector<Image16Bpp>& tilesets);
 void DoSpriteExport(const std::vector<Image16Bpp>& images, const std::shared_ptr<Palette>& palette);
 
 void DoDSExport(const std::vector<Image32Bpp>& images32, const std::vector<Image32Bpp>& tilesets32, const std::vector<Image32Bpp>& palettes32)
 {
+    // World maps are converted to 16 bits a band at a time as they are tiled.
+    bool world_map = params.world_map && !params.affine && (params.mode == "TILEMAP" || params.mode == "MAP");
     std::vector<Image16Bpp> images;
-    for (const auto& image : images32)
-        images.push_back(Image16Bpp(image));
+    if (!world_map)
+    {
+        for (const auto& image : images32)
+            images.push_back(Image16Bpp(image));
+    }
 
     std::vector<Image16Bpp> tilesets;
     for (const auto& image : tilesets32)
@@ -36,7 +42,9 @@ void DoDSExport(const std::vector<Image32Bpp>& images32, const std::vector<Image
         palette = scene.palette;
     }
 
-    if (params.mode == "TILEMAP")
+    if (world_map)
+        DoWorldMapExport(images32, tilesets);
+    else if (params.mode == "TILEMAP")
         DoMode0Export(images);
     else if (params.mode == "BITMAP")
         DoMode3Export(images);
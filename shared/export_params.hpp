@@ -44,7 +44,10 @@ struct ExportParams
     unsigned int offset;
     bool dither;
     float dither_level;
+    std::string dither_mode;
+    std::string dither_matrix;
     unsigned int palette_size;
+    std::string quantizer;
     bool split;
     bool affine;
     int bpp;
@@ -54,6 +57,15 @@ struct ExportParams
     int border;
     bool force;
     bool reduce;
+    bool flip_tiles;
+    unsigned int pack_time_ms;
+    unsigned int max_tiles;
+    bool nearest_tile;
+    bool world_map;
+    std::string map_layout;
+    std::string tile_stream;
+    int metatile;
+    bool vram_plan;
 
     // Sprite stuff
     bool for_bitmap;
@@ -85,6 +85,11 @@ void ExportFile::Add(std::unique_ptr<Exportable> image)
     exportables.push_back(std::move(image));
 }
 
+void ExportFile::PlanVram()
+{
+    vramBases = ::PlanVram(exportables);
+}
+
 std::map<std::string, std::vector<Image*>> ExportFile::GetAnimatedImages()
 {
     std::map<std::string, std::vector<Image*>> ret;
@@ -117,4 +122,5 @@ void ExportFile::Clear()
     transparent_color = 0;
     mode = "";
     exportables.clear();
+    vramBases.clear();
 }
@@ -13,13 +13,19 @@ void DoMode4Export(const std::vector<Image16Bpp>& images, const std::shared_ptr<
 void DoPaletteExport(const std::vector<Image16Bpp>& images);
 void DoTilesetExport(const std::vector<Image16Bpp>& images, const std::shared_ptr<Palette>& palette);
 void DoMapExport(const std::vector<Image16Bpp>& images, const std::vector<Image16Bpp>& tilesets);
+void DoWorldMapExport(const std::vector<Image32Bpp>& images, const std::vector<Image16Bpp>& tilesets);
 void DoSpriteExport(const std::vector<Image16Bpp>& images, const std::shared_ptr<Palette>& palette);
 
 void DoGBAExport(const std::vector<Image32Bpp>& images32, const std::vector<Image32Bpp>& tilesets32, const std::vector<Image32Bpp>& palettes32)
 {
+    // World maps are converted to 16 bits a band at a time as they are tiled.
+    bool world_map = params.world_map && !params.affine && (params.mode == "0" || params.mode == "TILEMAP" || params.mode == "MAP");
     std::vector<Image16Bpp> images;
-    for (const auto& image : images32)
-        images.push_back(Image16Bpp(image));
+    if (!world_map)
+    {
+        for (const auto& image : images32)
+            images.push_back(Image16Bpp(image));
+    }
 
     std::vector<Image16Bpp> tilesets;
     for (const auto& image : tilesets32)
@@ -38,7 +44,9 @@ void DoGBAExport(const std::vector<Image32Bpp>& images32, const std::vector<Imag
     if (params.affine && params.bpp == 4 && (params.mode == "0" || params.mode == "MAP" || params.mode == "TILES" || params.mode == "TILEMAP"))
         FatalLog("GBA Affine Maps are 8 bpp only.");
 
-    if (params.mode == "0" || params.mode == "TILEMAP")
+    if (world_map)
+        DoWorldMapExport(images32, tilesets);
+    else if (params.mode == "0" || params.mode == "TILEMAP")
         DoMode0Export(images);
     else if (params.mode == "3" || params.mode == "BITMAP")
         DoMode3Export(images);
@@ -87,10 +95,21 @@ void DoMode4Export(const std::vector<Image16Bpp>& images, const std::shared_ptr<
     // Add appropriate object to header/implementation.
     if (params.split)
     {
+        // Without a shared palette each image makes its own, otherwise they all search the same one.
+        if (palette && images.size() > 1)
+            palette->FillColormap();
+
         for (const auto& image : images)
+            Image8Bpp::CheckWidth(image);
+
+        std::vector<std::unique_ptr<Image8Bpp>> images8(images.size());
+        ParallelFor(images.size(), [&](unsigned int i)
         {
-            ExportFile::Add(std::make_unique<Image8Bpp>(image, palette));
-        }
+            images8[i] = std::make_unique<Image8Bpp>(images[i], palette);
+        });
+
+        for (auto& image : images8)
+            ExportFile::Add(std::move(image));
     }
     else
     {
@@ -136,3 +155,29 @@ void DoMapExport(const std::vector<Image16Bpp>& images, const std::vector<Image1
         ExportFile::Add(std::make_unique<Map>(image, tileset, params.affine));
     }
 }
+
+void DoWorldMapExport(const std::vector<Image32Bpp>& images, const std::vector<Image16Bpp>& tilesets)
+{
+    // As DoMode0Export and DoMapExport, the maps being tiled a band of tile rows at a time.
+    if (params.mode == "MAP")
+    {
+        if (tilesets.empty())
+            FatalLog("Map export specified however --tileset not given");
+
+        auto tileset = std::make_shared<Tileset>(tilesets, "", params.bpp, params.affine);
+        for (const auto& image : images)
+            ExportFile::Add(std::make_unique<Map>(image, tileset));
+    }
+    else if (params.split)
+    {
+        for (const auto& image : images)
+            ExportFile::Add(std::make_unique<Map>(image, params.bpp));
+    }
+    else
+    {
+        std::vector<const Image32Bpp*> maps;
+        for (const auto& image : images)
+            maps.push_back(&image);
+        ExportFile::Add(std::make_unique<MapScene>(maps, params.symbol_base_name, params.bpp));
+    }
+}
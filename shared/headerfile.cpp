@@ -43,6 +43,10 @@ void HeaderFile::Write(std::ostream& file)
     for (const auto& exportable : exportables)
         exportable->WriteExport(file);
 
+    for (const auto& base : vramBases)
+        WriteDefine(file, base.name, base.append, base.base);
+    if (!vramBases.empty()) WriteNewLine(file);
+
     for (unsigned int i = 0; i < params.names.size(); i++)
     {
         const std::string& name = params.names[i];
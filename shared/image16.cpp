@@ -7,13 +7,20 @@
 #include "image32.hpp"
 #include "shared.hpp"
 
-Image16Bpp::Image16Bpp(const Image32Bpp& image) : Image(image), pixels(width * height)
+Image16Bpp::Image16Bpp(const Image32Bpp& image) : Image16Bpp(image, 0, image.height)
 {
+}
+
+Image16Bpp::Image16Bpp(const Image32Bpp& image, unsigned int y, unsigned int rows) : Image(image), pixels(width * rows)
+{
+    height = rows;
     unsigned int num_pixels = width * height;
-    const std::vector<Color>& pixels32 = image.pixels;
+    std::vector<Color> buffer;
+    const Color* pixels32 = image.Rows(y, rows, buffer);
 
     for (unsigned int i = 0; i < num_pixels; i++)
         pixels[i] = Color16(pixels32[i]);
+    blocks = BlockPixels(pixels, width, height);
 }
 
 void Image16Bpp::WriteData(std::ostream& file) const
@@ -44,3 +51,32 @@ void Image16Bpp::WriteExport(std::ostream& file) const
     }
     WriteNewLine(file);
 }
+
+ImageBands::ImageBands(const std::vector<Image16Bpp>& _images) : images(&_images)
+{
+    for (const auto& image : _images)
+        bands.push_back({&image, nullptr, 0});
+}
+
+ImageBands::ImageBands(const Image16Bpp& image) : images(nullptr)
+{
+    bands.push_back({&image, nullptr, 0});
+}
+
+ImageBands::ImageBands(const std::vector<const Image32Bpp*>& world_maps) : images(nullptr)
+{
+    for (const auto& image : world_maps)
+    {
+        for (unsigned int row = 0; row < image->height / 8; row++)
+            bands.push_back({nullptr, image, row});
+    }
+}
+
+const Image16Bpp& ImageBands::Get(unsigned int index) const
+{
+    const Band& b = bands[index];
+    if (b.image16)
+        return *b.image16;
+    band.reset(new Image16Bpp(*b.image32, b.row * 8, 8));
+    return *band;
+}
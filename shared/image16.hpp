@@ -2,6 +2,7 @@
 #define IMAGE16_HPP
 
 #include <Magick++.h>
+#include <memory>
 #include <vector>
 
 #include "image.hpp"
@@ -16,11 +17,44 @@ class Image16Bpp : public Image
 {
     public:
         Image16Bpp(const Image32Bpp& image);
+        /** Band of rows y to y + rows - 1 of image */
+        Image16Bpp(const Image32Bpp& image, unsigned int y, unsigned int rows);
         void WriteData(std::ostream& file) const;
         void WriteCommonExport(std::ostream& file) const;
         void WriteExport(std::ostream& file) const;
         const Color16& At(int x, int y) const {return pixels[y * width + x];}
+        /** First of the 64 pixels of tile (tilex, tiley) in blocks */
+        const Color16* BlockAt(int tilex, int tiley) const {return &blocks[(tiley * (width / 8) + tilex) * 64];}
         std::vector<Color16> pixels;
+        /** Pixels tile by tile so tiles can be copied whole, empty if width or height isn't a multiple of 8 */
+        std::vector<Color16> blocks;
+};
+
+/** Images tiled one after another, either whole or world maps a band of one row of tiles at a time
+  * so that a world map is never held whole at 16 bits. */
+class ImageBands
+{
+    public:
+        ImageBands(const std::vector<Image16Bpp>& images);
+        ImageBands(const Image16Bpp& image);
+        ImageBands(const std::vector<const Image32Bpp*>& world_maps);
+        unsigned int Size() const {return bands.size();}
+        /** Band index, for world maps only valid until the next call */
+        const Image16Bpp& Get(unsigned int index) const;
+        /** Tile row of its image band index starts at */
+        unsigned int Row(unsigned int index) const {return bands[index].row;}
+        /** The images if given as whole images, else nullptr */
+        const std::vector<Image16Bpp>* Images() const {return images;}
+    private:
+        struct Band
+        {
+            const Image16Bpp* image16;
+            const Image32Bpp* image32;
+            unsigned int row;
+        };
+        std::vector<Band> bands;
+        const std::vector<Image16Bpp>* images;
+        mutable std::unique_ptr<Image16Bpp> band;
 };
 
 #endif
@@ -47,10 +47,22 @@ ArrayDataType3DS GetArrayDataType3DS(const std::string& pixel_format)
     return INVALID_DATA;
 }
 
-Image32Bpp::Image32Bpp(const Magick::Image& image, const std::string& name, const std::string& filename, unsigned int frame, bool animated) :
+Image32Bpp::Image32Bpp(const Magick::Image& image, const std::string& name, const std::string& filename, unsigned int frame, bool animated, bool banded) :
     Image(image.columns(), image.rows(), name, filename, frame, animated)
 {
-    CopyMagickPixels(image, pixels);
+    if (banded)
+        source = image;
+    else
+        CopyMagickPixels(image, 0, height, pixels);
+}
+
+const Color* Image32Bpp::Rows(unsigned int y, unsigned int rows, std::vector<Color>& buffer) const
+{
+    if (!pixels.empty())
+        return &pixels[y * width];
+    buffer.clear();
+    CopyMagickPixels(source, y, rows, buffer);
+    return buffer.data();
 }
 
 void Image32Bpp::WriteData(std::ostream& file) const
@@ -14,12 +14,18 @@
 class Image32Bpp : public Image
 {
     public:
-        Image32Bpp(const Magick::Image& image, const std::string& name, const std::string& filename, unsigned int frame, bool animated);
+        /** If banded the pixels are left in image and read a band of rows at a time with Rows, for world maps */
+        Image32Bpp(const Magick::Image& image, const std::string& name, const std::string& filename, unsigned int frame, bool animated, bool banded = false);
+        /** First pixel of rows y to y + rows - 1, read into buffer if the pixels aren't held */
+        const Color* Rows(unsigned int y, unsigned int rows, std::vector<Color>& buffer) const;
         void WriteData(std::ostream& file) const;
         void WriteCommonExport(std::ostream& file) const;
         void WriteExport(std::ostream& file) const;
         virtual std::string GetImageType() const {return "const unsigned char*";}
         std::vector<Color> pixels;
+    private:
+        /** Image the rows of a banded image are read from */
+        Magick::Image source;
 };
 
 #endif
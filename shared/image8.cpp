@@ -11,12 +11,6 @@
 Image8Bpp::Image8Bpp(const Image16Bpp& image, std::shared_ptr<Palette> global_palette) :
     Image(image), pixels(width * height), palette(global_palette), export_shared_info(global_palette == nullptr)
 {
-    // If the image width is odd error out
-    if (width & 1 && !params.force)
-        FatalLog("Image: %s width is not a multiple of 2. Found (%d, %d). Please fix. Use --force to override this.", name.c_str(), width, height);
-    else if (width & 1 && params.force)
-        WarnLog("Image: %s width is not a multiple of 2. Found (%d %d). Image data can't be written to the screen with DMA.", name.c_str(), width, height);
-
     if (!palette)
     {
         palette.reset(new Palette(export_name));
@@ -24,6 +18,16 @@ Image8Bpp::Image8Bpp(const Image16Bpp& image, std::shared_ptr<Palette> global_pa
     }
 
     DitherAndReduceImage(image, params.transparent_color, params.dither, params.dither_level, params.offset, *this);
+    blocks = BlockPixels(pixels, width, height);
+}
+
+void Image8Bpp::CheckWidth(const Image16Bpp& image)
+{
+    // If the image width is odd error out
+    if (image.width & 1 && !params.force)
+        FatalLog("Image: %s width is not a multiple of 2. Found (%d, %d). Please fix. Use --force to override this.", image.name.c_str(), image.width, image.height);
+    else if (image.width & 1 && params.force)
+        WarnLog("Image: %s width is not a multiple of 2. Found (%d %d). Image data can't be written to the screen with DMA.", image.name.c_str(), image.width, image.height);
 }
 
 void Image8Bpp::WriteData(std::ostream& file) const
@@ -62,13 +66,9 @@ void Image8Bpp::WriteExport(std::ostream& file) const
 Image8BppScene::Image8BppScene(const std::vector<Image16Bpp>& images16, const std::string& name, std::shared_ptr<Palette> global_palette) :
     Scene(name), palette(global_palette), export_shared_info(global_palette == nullptr)
 {
+    // Checked here since the images are built on worker threads, which must not log warnings or errors.
     for (const auto& image : images16)
-    {
-        if (image.width & 1 && !params.force)
-            FatalLog("Image: %s width is not a multiple of 2. Found (%d %d). Please fix.", name.c_str(), image.width, image.height);
-        else if (image.width & 1 && params.force)
-            WarnLog("Image: %s width is not a multiple of 2. Found (%d %d). Image data can't be written to the screen with DMA.", name.c_str(), image.width, image.height);
-    }
+        Image8Bpp::CheckWidth(image);
 
     if (!palette)
     {
@@ -76,9 +76,15 @@ Image8BppScene::Image8BppScene(const std::vector<Image16Bpp>& images16, const st
         GetPalette(images16, params.palette_size, params.transparent_color, params.offset, *palette);
     }
 
-    images.reserve(images16.size());
-    for (const auto& image : images16)
-        images.emplace_back(new Image8Bpp(image, palette));
+    // Dithering each image is independent once the palette can be searched concurrently.
+    if (images16.size() > 1)
+        palette->FillColormap();
+
+    images.resize(images16.size());
+    ParallelFor(images16.size(), [&](unsigned int i)
+    {
+        images[i].reset(new Image8Bpp(images16[i], palette));
+    });
 }
 
 const Image8Bpp& Image8BppScene::GetImage(int index) const
@@ -18,14 +18,21 @@ class Image16Bpp;
 class Image8Bpp : public Image
 {
     public:
+        /** Images are built on worker threads, so callers check the width with CheckWidth first */
         Image8Bpp(const Image16Bpp& image, std::shared_ptr<Palette> global_palette = nullptr);
+        /** Errors out (or warns with --force) if the width of image is odd */
+        static void CheckWidth(const Image16Bpp& image);
         void WriteData(std::ostream& file) const;
         void WriteCommonExport(std::ostream& file) const;
         void WriteExport(std::ostream& file) const;
         virtual bool HasPalette() const {return true;}
         unsigned char At(int x, int y) const {return pixels[y * width + x];}
         Magick::Image ToMagick() const;
+        /** First of the 64 pixels of tile (tilex, tiley) in blocks */
+        const unsigned char* BlockAt(int tilex, int tiley) const {return &blocks[(tiley * (width / 8) + tilex) * 64];}
         std::vector<unsigned char> pixels;
+        /** Pixels tile by tile so tiles can be copied whole, empty if width or height isn't a multiple of 8 */
+        std::vector<unsigned char> blocks;
         /** Palette this image uses */
         std::shared_ptr<Palette> palette;
     private:
@@ -0,0 +1,129 @@
+#include "quantizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "logger.hpp"
+#include "shared.hpp"
+
+// Colors assigned per ParallelFor call, fixed so the sums add up the same whatever the number of cores.
+#define KMEANS_COLORS_PER_CHUNK 4096
+
+struct KMeansSums
+{
+    KMeansSums(unsigned int clusters) : l(clusters), a(clusters), b(clusters), count(clusters) {}
+    std::vector<double> l, a, b;
+    std::vector<unsigned long> count;
+};
+
+/** Assigns colors [begin, end) to their nearest center, accumulating the weighted sums of each cluster */
+static void AssignColors(const std::vector<ColorLAB>& colors, const std::vector<ColorCount>& counts, const std::vector<ColorLAB>& centers,
+                         size_t begin, size_t end, std::vector<unsigned int>& assignments, KMeansSums& sums, unsigned long& changed)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        const ColorLAB& color = colors[i];
+        unsigned int best = 0;
+        unsigned long bestd = color.Distance(centers[0]);
+        for (unsigned int k = 1; k < centers.size() && bestd != 0; k++)
+        {
+            unsigned long dist = color.Distance(centers[k]);
+            if (dist < bestd)
+            {
+                bestd = dist;
+                best = k;
+            }
+        }
+
+        if (assignments[i] != best)
+        {
+            assignments[i] = best;
+            changed++;
+        }
+
+        unsigned long count = counts[i].count;
+        sums.l[best] += (double)color.l * count;
+        sums.a[best] += (double)color.a * count;
+        sums.b[best] += (double)color.b * count;
+        sums.count[best] += count;
+    }
+}
+
+void KMeansQuantizer::Quantize(const std::vector<ColorCount>& colors, unsigned int num_colors, std::vector<Color16>& palette) const
+{
+    EventLog l(__func__);
+
+    if (colors.empty() || num_colors == 0)
+        return;
+
+    // Seed with median cut, which may pad its palette with duplicates of black.
+    std::vector<Color16> seeds;
+    MedianCutQuantizer().Quantize(colors, num_colors, seeds);
+    std::vector<ColorLAB> centers;
+    for (const auto& seed : seeds)
+    {
+        ColorLAB center(seed);
+        if (std::find(centers.begin(), centers.end(), center) == centers.end())
+            centers.push_back(center);
+    }
+
+    std::vector<ColorLAB> labColors;
+    labColors.reserve(colors.size());
+    for (const auto& color_count : colors)
+        labColors.push_back(ColorLAB(color_count.color));
+
+    unsigned int num_chunks = (colors.size() + KMEANS_COLORS_PER_CHUNK - 1) / KMEANS_COLORS_PER_CHUNK;
+
+    // Start with an impossible assignment so the first pass counts every color as changed.
+    std::vector<unsigned int> assignments(colors.size(), centers.size());
+    std::vector<unsigned long> cluster_sizes(centers.size());
+
+    unsigned int iteration = 0;
+    for (; iteration < iterations; iteration++)
+    {
+        std::vector<KMeansSums> sums(num_chunks, KMeansSums(centers.size()));
+        std::vector<unsigned long> changed(num_chunks);
+        ParallelFor(num_chunks, [&](unsigned int t)
+        {
+            size_t begin = (size_t)t * KMEANS_COLORS_PER_CHUNK;
+            size_t end = std::min(colors.size(), begin + KMEANS_COLORS_PER_CHUNK);
+            AssignColors(labColors, colors, centers, begin, end, assignments, sums[t], changed[t]);
+        });
+
+        unsigned long total_changed = 0;
+        for (unsigned int t = 0; t < num_chunks; t++)
+            total_changed += changed[t];
+
+        // Centers from the previous pass are already the means of this assignment.
+        if (total_changed == 0)
+            break;
+
+        for (unsigned int k = 0; k < centers.size(); k++)
+        {
+            double l = 0, a = 0, b = 0;
+            unsigned long count = 0;
+            for (unsigned int t = 0; t < num_chunks; t++)
+            {
+                l += sums[t].l[k];
+                a += sums[t].a[k];
+                b += sums[t].b[k];
+                count += sums[t].count[k];
+            }
+            cluster_sizes[k] = count;
+            if (!count)
+                continue;
+            centers[k] = ColorLAB(round(l / count), round(a / count), round(b / count));
+        }
+    }
+
+    VerboseLog("K-means ran %d iterations of %d for %d colors", iteration, iterations, num_colors);
+
+    for (unsigned int k = 0; k < centers.size(); k++)
+    {
+        if (!cluster_sizes[k])
+            continue;
+        Color16 color(centers[k]);
+        if (std::find(palette.begin(), palette.end(), color) == palette.end())
+            palette.push_back(color);
+    }
+}
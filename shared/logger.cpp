@@ -80,6 +80,7 @@ void AbstractLogger::Log(LogLevel level, const char* format, va_list ap)
     if (level > log_level)
         return;
 
+    std::lock_guard<std::mutex> lock(log_mutex);
     if (log_time)
     {
         std::chrono::time_point<std::chrono::system_clock> time_now(std::chrono::system_clock::now());
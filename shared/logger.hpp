@@ -5,6 +5,7 @@
 #include <cstdarg>
 #include <memory>
 #include <chrono>
+#include <mutex>
 
 enum class LogLevel
 {
@@ -29,6 +30,8 @@ class AbstractLogger
         std::ostream* out;
         LogLevel log_level;
         bool log_time;
+        /** Keeps lines logged from different threads apart */
+        std::mutex log_mutex;
 };
 
 class Logger : public AbstractLogger
@@ -18,7 +18,7 @@ unsigned int clamp_quantum(Magick::Quantum q, size_t depth)
 class MagickImageDataWrapper
 {
 public:
-    MagickImageDataWrapper(const Magick::Image& image) : constPixels(image.getConstPixels(0, 0, image.columns(), image.rows())), pixels(nullptr), channels(0)
+    MagickImageDataWrapper(const Magick::Image& image, unsigned int y, unsigned int rows) : constPixels(image.getConstPixels(0, y, image.columns(), rows)), pixels(nullptr), channels(0)
     {
 #ifdef MAGICK6_SUPPORT
         alpha_mask = image.matte() ? 0 : 0xFF;
@@ -99,10 +99,10 @@ private:
     size_t depth;
 };
 
-void CopyMagickPixels(const Magick::Image& image, std::vector<Color>& out)
+void CopyMagickPixels(const Magick::Image& image, unsigned int y, unsigned int rows, std::vector<Color>& out)
 {
-    unsigned int num_pixels = image.rows() * image.columns();
-    MagickImageDataWrapper imageData(image);
+    unsigned int num_pixels = rows * image.columns();
+    MagickImageDataWrapper imageData(image, y, rows);
     for (unsigned int i = 0; i < num_pixels; i++)
     {
         unsigned char r, g, b, a;
@@ -281,13 +281,14 @@ Magick::Image ToMagick(const Map& map)
         {
             int sx = i % map.width * 8;
             int sy = i / map.width * 8;
-            int tile_id = map.data[i] & 0x3FF;
+            int tile_id = map.tileIds[i];
+            int flip = (map.data[i] >> 10) & 0x3;
             int pal_id = (map.data[i] >> 12) & 0xF;
             const Tile& tile = tileset.tilesExport[tile_id];
             const PaletteBank& palette = tileset.paletteBanks[pal_id];
             for (unsigned int j = 0; j < TILE_SIZE; j++)
             {
-                unsigned char pix = tile.pixels[j];
+                unsigned char pix = tile.pixels[FlippedIndex(j, flip)];
                 if (!pix) continue;
                 imageData.setPixel(sx + j % 8 + (sy + j / 8) * width, palette.At(pix).ToColor());
             }
@@ -299,12 +300,13 @@ Magick::Image ToMagick(const Map& map)
         {
             int sx = i % map.width * 8;
             int sy = i / map.width * 8;
-            int tile_id = map.data[i] & 0x3FF;
+            int tile_id = map.tileIds[i];
+            int flip = (map.data[i] >> 10) & 0x3;
             const Tile& tile = tileset.tilesExport[tile_id];
             const Palette& palette = *tileset.palette;
             for (unsigned int j = 0; j < TILE_SIZE; j++)
             {
-                unsigned char pix = tile.pixels[j];
+                unsigned char pix = tile.pixels[FlippedIndex(j, flip)];
                 if (!pix) continue;
                 imageData.setPixel(sx + j % 8 + (sy + j / 8) * width, palette.At(pix).ToColor());
             }
@@ -5,7 +5,8 @@
 #include <vector>
 #include "alltypes.hpp"
 
-void CopyMagickPixels(const Magick::Image& image, std::vector<Color>& out);
+/** Appends the pixels of rows y to y + rows - 1 of image to out */
+void CopyMagickPixels(const Magick::Image& image, unsigned int y, unsigned int rows, std::vector<Color>& out);
 Magick::Image ToMagick(const Image32Bpp& image);
 Magick::Image ToMagick(const Image16Bpp& image);
 Magick::Image ToMagick(const Image8Bpp& image);
@@ -1,12 +1,36 @@
 #include "map.hpp"
 
+#include <algorithm>
+#include <cmath>
+
 #include "logger.hpp"
+#include "export_params.hpp"
 #include "fileutils.hpp"
 #include "image16.hpp"
+#include "image32.hpp"
+#include "shared.hpp"
 #include "tileset.hpp"
 
-void ValidateMapSize(const Image16Bpp& image, bool affine)
+void ValidateMapSize(const Image& image, bool affine)
 {
+    if (params.metatile && affine)
+        FatalLog("Image: %s Affine maps can't use metatiles. Please fix.", image.name.c_str());
+    if (affine && params.map_layout != "sbb" && params.map_layout != "rowmajor")
+        FatalLog("Image: %s Affine maps are always exported row major. Please fix.", image.name.c_str());
+    if (affine && params.tile_stream != "none")
+        FatalLog("Image: %s Affine maps can't stream tiles. Please fix.", image.name.c_str());
+    if (params.world_map && params.map_layout == "sbb" && !params.metatile)
+        FatalLog("Image: %s World maps don't fit the screenblock layout, use another --map_layout. Please fix.", image.name.c_str());
+
+    if (params.world_map)
+    {
+        if (affine)
+            FatalLog("Image: %s World maps can't be affine, affine maps can't be streamed in screenblocks. Please fix.", image.name.c_str());
+        else if (image.width % 8 || image.height % 8)
+            FatalLog("Invalid world map size for image %s, (%d %d). Dimensions must be multiples of 8. Please fix.", image.name.c_str(), image.width, image.height);
+        return;
+    }
+
     if ((image.width != 256 && image.width != 512) || (image.height != 256 && image.height != 512))
         FatalLog("Invalid map size for image %s, (%d %d). Please fix. Use --force to override.", image.name.c_str(), image.width, image.height);
     else if (affine)
@@ -22,82 +46,284 @@ Map::Map(const Image16Bpp& image, int bpp, bool _affine) : Image(image.width / 8
     ValidateMapSize(image, affine);
     // Create tileset according to bpp
     tileset.reset(Tileset::FromImage(image, bpp, affine));
+    if (params.metatile)
+        metatileset.reset(new Metatileset(name, params.metatile));
 
-    // Tile match each tile in image
-    switch(bpp)
-    {
-        case 4:
-            Init4bpp(image);
-            break;
-        default:
-            Init8bpp(image);
-            break;
-    }
+    Init(ImageBands(image));
 }
 
-Map::Map(const Image16Bpp& image, std::shared_ptr<Tileset>& global_tileset, bool _affine) : Image(image.width / 8, image.height / 8, image.name, image.filename, image.frame, image.animated),
-    data(width * height), tileset(global_tileset), export_shared_info(false), affine(_affine)
+Map::Map(const Image16Bpp& image, std::shared_ptr<Tileset>& global_tileset, bool _affine, const std::shared_ptr<Metatileset>& global_metatileset) :
+    Image(image.width / 8, image.height / 8, image.name, image.filename, image.frame, image.animated),
+    data(width * height), tileset(global_tileset), metatileset(global_metatileset), export_shared_info(false), affine(_affine)
 {
     ValidateMapSize(image, affine);
+    Init(ImageBands(image));
+}
+
+Map::Map(const Image32Bpp& image, int bpp) : Image(image.width / 8, image.height / 8, image.name, image.filename, image.frame, image.animated),
+    data(width * height), tileset(NULL), export_shared_info(true), affine(false)
+{
+    ValidateMapSize(image, affine);
+    ImageBands bands({&image});
+    tileset.reset(new Tileset(bands, "", bpp, affine));
+    if (params.metatile)
+        metatileset.reset(new Metatileset(name, params.metatile));
 
-    switch(tileset->bpp)
+    Init(bands);
+}
+
+Map::Map(const Image32Bpp& image, std::shared_ptr<Tileset>& global_tileset, const std::shared_ptr<Metatileset>& global_metatileset) :
+    Image(image.width / 8, image.height / 8, image.name, image.filename, image.frame, image.animated),
+    data(width * height), tileset(global_tileset), metatileset(global_metatileset), export_shared_info(false), affine(false)
+{
+    ValidateMapSize(image, affine);
+    Init(ImageBands({&image}));
+}
+
+void Map::Init(const ImageBands& images)
+{
+    // Tile match each tile in image, a band at a time for world maps
+    int nearest = 0;
+    tileIds.resize(data.size());
+    for (unsigned int k = 0; k < images.Size(); k++)
     {
-        case 4:
-            Init4bpp(image);
-            break;
-        default:
-            Init8bpp(image);
-            break;
+        switch(tileset->bpp)
+        {
+            case 4:
+                nearest += Init4bpp(images.Get(k), images.Row(k));
+                break;
+            default:
+                nearest += Init8bpp(images.Get(k), images.Row(k));
+                break;
+        }
     }
+    if (nearest)
+        InfoLog("Image: %s %d tiles not in the tileset use the closest looking tile instead.", name.c_str(), nearest);
+
+    if (params.tile_stream != "none")
+        InitStream();
+    if (metatileset)
+        InitMetatiles();
+    else if (params.map_layout == "chunked")
+        InitChunks();
 }
 
-void Map::Init4bpp(const Image16Bpp& image)
+int Map::Init4bpp(const Image16Bpp& image, unsigned int row)
 {
-    for (unsigned int i = 0; i < data.size(); i++)
+    int nearest = 0;
+    unsigned int start = row * width;
+    unsigned int end = start + width * (image.height / 8);
+    for (unsigned int i = start; i < end; i++)
     {
         int tilex = i % width;
         int tiley = i / width;
-        ImageTile imageTile(image, tilex, tiley);
+        ImageTile imageTile(image, tilex, tiley - row);
         int tile_id = 0;
         int pal_id = 0;
+        int flip = 0;
 
-        if (!tileset->Match(imageTile, tile_id, pal_id))
+        bool matched = tileset->Match(imageTile, tile_id, pal_id, flip);
+        if (!matched && params.nearest_tile && MatchNearest(image, imageTile, tilex, tiley, tile_id, pal_id, flip))
+        {
+            matched = true;
+            nearest++;
+        }
+        if (!matched)
         {
             WarnLog("Image: %s No match for tile starting at (%d %d) px, using empty tile instead.", image.name.c_str(), tilex * 8, tiley * 8);
             WarnLog("Image: %s No match for palette for tile starting at (%d %d) px, using palette 0 instead.", image.name.c_str(), tilex * 8, tiley * 8);
         }
         VerboseLog("%d %d => %d %d", tilex, tiley, pal_id, tile_id);
-        data[i] = pal_id << 12 | tile_id;
+        tileIds[i] = tile_id;
+        data[i] = pal_id << 12 | flip << 10 | (tile_id & 0x3FF);
     }
+    return nearest;
 }
 
-void Map::Init8bpp(const Image16Bpp& image)
+int Map::Init8bpp(const Image16Bpp& image, unsigned int row)
 {
-    for (unsigned int i = 0; i < data.size(); i++)
+    int nearest = 0;
+    unsigned int start = row * width;
+    unsigned int end = start + width * (image.height / 8);
+    for (unsigned int i = start; i < end; i++)
     {
         int tilex = i % width;
         int tiley = i / width;
-        ImageTile tile(image, tilex, tiley);
+        ImageTile tile(image, tilex, tiley - row);
         int tile_id = 0;
         int pal_id = 0;
+        int flip = 0;
 
-        if (!tileset->Match(tile, tile_id, pal_id))
+        bool matched = tileset->Match(tile, tile_id, pal_id, flip);
+        if (!matched && params.nearest_tile && MatchNearest(image, tile, tilex, tiley, tile_id, pal_id, flip))
+        {
+            matched = true;
+            nearest++;
+        }
+        if (!matched)
             WarnLog("Image: %s No match for tile starting at (%d %d) px, using empty tile instead.", image.name.c_str(), tilex * 8, tiley * 8);
 
-        data[i] = tile_id;
+        tileIds[i] = tile_id;
+        data[i] = flip << 10 | (tile_id & 0x3FF);
+    }
+    return nearest;
+}
+
+bool Map::MatchNearest(const Image& image, const ImageTile& tile, int tilex, int tiley, int& tile_id, int& pal_id, int& flip) const
+{
+    unsigned long distance;
+    if (!tileset->MatchNearest(tile, tile_id, pal_id, flip, distance))
+        return false;
+    VerboseLog("Image: %s Tile starting at (%d %d) px is not in the tileset, using tile %d flip %d instead, %.1f per pixel off.",
+               image.name.c_str(), tilex * 8, tiley * 8, tile_id, flip, sqrt(distance / (double)TILE_SIZE));
+    return true;
+}
+
+void Map::InitStream()
+{
+    // A screen sized window plus the column and row partly scrolled into view, 31x21 tiles on the GBA.
+    unsigned int screen_width = params.device == "NDS" ? 256 : 240;
+    unsigned int screen_height = params.device == "NDS" ? 192 : 160;
+    stream.reset(new TileStream(export_name, tileIds, width, height, params.tile_stream == "columns", screen_width / 8 + 1, screen_height / 8 + 1));
+    for (unsigned int i = 0; i < data.size(); i++)
+        data[i] = (data[i] & 0xFC00) | stream->slots[i];
+}
+
+void Map::InitChunks()
+{
+    unsigned int chunks_width = (width + 31) / 32;
+    unsigned int chunks_height = (height + 31) / 32;
+
+    // Chunks that are the same, like open sky, are kept once.
+    TileIndex index;
+    std::vector<unsigned short> chunk(SIZE_SBB_SHORTS);
+    for (unsigned int cy = 0; cy < chunks_height; cy++)
+    {
+        for (unsigned int cx = 0; cx < chunks_width; cx++)
+        {
+            for (unsigned int y = 0; y < 32; y++)
+            {
+                for (unsigned int x = 0; x < 32; x++)
+                {
+                    // Past the edge of the map use the null tile
+                    unsigned int mx = cx * 32 + x;
+                    unsigned int my = cy * 32 + y;
+                    chunk[y * 32 + x] = (mx < width && my < height) ? data[my * width + mx] : 0;
+                }
+            }
+
+            uint64_t key = HashBytes(chunk.data(), SIZE_SBB_BYTES);
+            int id = index.Find(key, [&](int id) {return std::equal(chunk.begin(), chunk.end(), chunks.begin() + id * SIZE_SBB_SHORTS);});
+            if (id == -1)
+            {
+                id = chunks.size() / SIZE_SBB_SHORTS;
+                index.Insert(key, id);
+                chunks.insert(chunks.end(), chunk.begin(), chunk.end());
+            }
+            chunkIndex.push_back(id);
+        }
     }
+    InfoLog("Image: %s World map is %u x %u screenblocks, %zu of them distinct.", name.c_str(), chunks_width, chunks_height, chunks.size() / SIZE_SBB_SHORTS);
+}
+
+void Map::InitMetatiles()
+{
+    int size = metatileset->size;
+    unsigned int metamap_width = (width + size - 1) / size;
+    unsigned int metamap_height = (height + size - 1) / size;
+    unsigned int num_metatiles = metatileset->Size();
+
+    std::vector<unsigned short> block(size * size);
+    metamap.reserve(metamap_width * metamap_height);
+    for (unsigned int my = 0; my < metamap_height; my++)
+    {
+        for (unsigned int mx = 0; mx < metamap_width; mx++)
+        {
+            for (int y = 0; y < size; y++)
+            {
+                for (int x = 0; x < size; x++)
+                {
+                    // Past the edge of the map use the null tile
+                    unsigned int tx = mx * size + x;
+                    unsigned int ty = my * size + y;
+                    block[y * size + x] = (tx < width && ty < height) ? data[ty * width + tx] : 0;
+                }
+            }
+            metamap.push_back(metatileset->Add(block));
+        }
+    }
+    InfoLog("Image: %s %u of %u metatiles are new, %u metatiles total.", name.c_str(), metatileset->Size() - num_metatiles, metamap.size(), metatileset->Size());
+    if (metatileset->Size() > 65536)
+        FatalLog("Too many metatiles. Found %d metatiles. Maximum is 65536. Please make the map simpler.", metatileset->Size());
+}
+
+unsigned int Map::ExportLength() const
+{
+    if (metatileset)
+        return metamap.size();
+    if (params.map_layout == "chunked")
+        return chunks.size();
+    return data.size() / (affine ? 2 : 1);
+}
+
+unsigned int Map::VramSize() const
+{
+    // Affine entries are bytes. Maps bigger than 64x64 are scrolled through a 64x64 map.
+    if (affine)
+        return std::max(width * height, (unsigned int)SIZE_SBB_BYTES);
+    if (width > 64 || height > 64)
+        return 4 * SIZE_SBB_BYTES;
+    int type = (width > 32 ? 1 : 0) | (height > 32 ? 1 : 0) << 1;
+    return (type == 0 ? 1 : (type < 3 ? 2 : 4)) * SIZE_SBB_BYTES;
 }
 
 void Map::WriteData(std::ostream& file) const
 {
     // Sole owner of tileset.
     if (export_shared_info)
+    {
         tileset->WriteData(file);
+        if (metatileset)
+            metatileset->WriteData(file);
+    }
 
-    if (affine)
+    if (metatileset)
+    {
+        int size = metatileset->size;
+        WriteLayoutData(file, metamap, (width + size - 1) / size, (height + size - 1) / size);
+    }
+    else if (affine)
         WriteAffineData(file);
-    else
+    else if (params.map_layout == "chunked")
+        WriteChunkData(file);
+    else if (params.map_layout == "sbb")
         WriteSbbData(file);
+    else
+        WriteLayoutData(file, data, width, height);
+
+    if (stream)
+        stream->WriteData(file);
+}
+
+void Map::WriteLayoutData(std::ostream& file, const std::vector<unsigned short>& entries, unsigned int entries_width, unsigned int entries_height) const
+{
+    // Column major puts each column in one run, so a horizontal scroller copies the next column with one transfer.
+    if (params.map_layout != "colmajor")
+    {
+        WriteShortArray(file, export_name, "", entries, 16);
+    }
+    else
+    {
+        std::vector<unsigned short> columns;
+        columns.reserve(entries.size());
+        for (unsigned int x = 0; x < entries_width; x++)
+        {
+            for (unsigned int y = 0; y < entries_height; y++)
+                columns.push_back(entries[y * entries_width + x]);
+        }
+        WriteShortArray(file, export_name, "", columns, 16);
+    }
+    WriteNewLine(file);
 }
 
 void Map::WriteAffineData(std::ostream& file) const
@@ -106,6 +332,14 @@ void Map::WriteAffineData(std::ostream& file) const
     WriteNewLine(file);
 }
 
+void Map::WriteChunkData(std::ostream& file) const
+{
+    WriteShortArray(file, export_name, "", chunks, 8);
+    WriteNewLine(file);
+    WriteShortArray(file, export_name, "_chunks", chunkIndex, 16);
+    WriteNewLine(file);
+}
+
 void Map::WriteSbbData(std::ostream& file) const
 {
     char buffer[7];
@@ -147,13 +381,17 @@ void Map::WriteSbbData(std::ostream& file) const
 
 void Map::WriteCommonExport(std::ostream& file) const
 {
-    unsigned int size = data.size() / (affine ? 2 : 1);
+    unsigned int size = ExportLength();
 
     WriteDefine(file, name, "_MAP_WIDTH", width);
     WriteDefine(file, name, "_MAP_HEIGHT", height);
     WriteDefine(file, name, "_MAP_SIZE", size * 2);
     WriteDefine(file, name, "_MAP_LENGTH", size);
-    if (affine)
+    if (metatileset)
+        WriteMetamapExport(file, name);
+    if (params.map_layout == "chunked" && !metatileset)
+        WriteChunkExport(file, name);
+    else if (affine)
         WriteDefine(file, name, "_MAP_TYPE", log2(width) - 4, 14);
     else
         WriteDefine(file, name, "_MAP_TYPE", (width > 32 ? 1 : 0) | (height > 32 ? 1 : 0) << 1, 14);
@@ -163,22 +401,51 @@ void Map::WriteExport(std::ostream& file) const
 {
     // Sole owner of tileset.
     if (export_shared_info)
+    {
         tileset->WriteExport(file);
+        if (metatileset)
+            metatileset->WriteExport(file);
+    }
 
-    unsigned int size = data.size() / (affine ? 2 : 1);
+    unsigned int size = ExportLength();
     WriteExtern(file, "const unsigned short", export_name, "", size);
+    if (params.map_layout == "chunked" && !metatileset)
+        WriteExtern(file, "const unsigned short", export_name, "_chunks", chunkIndex.size());
     if (!animated)
     {
         WriteDefine(file, export_name, "_MAP_WIDTH", width);
         WriteDefine(file, export_name, "_MAP_HEIGHT", height);
         WriteDefine(file, export_name, "_MAP_SIZE", size * 2);
         WriteDefine(file, export_name, "_MAP_LENGTH", size);
-        if (affine)
+        if (metatileset)
+            WriteMetamapExport(file, export_name);
+        if (params.map_layout == "chunked" && !metatileset)
+            WriteChunkExport(file, export_name);
+        else if (affine)
             WriteDefine(file, export_name, "_MAP_TYPE", log2(width) - 4, 14);
         else
             WriteDefine(file, export_name, "_MAP_TYPE", (width > 32 ? 1 : 0) | (height > 32 ? 1 : 0) << 1, 14);
         }
     WriteNewLine(file);
+    if (stream)
+        stream->WriteExport(file);
+}
+
+void Map::WriteChunkExport(std::ostream& file, const std::string& symbol) const
+{
+    // Chunk (x, y) is symbol + symbol_chunks[y * symbol_MAP_CHUNKS_WIDTH + x] * 1024. Streaming the 2x2 chunks around the camera
+    // into the screenblocks of a 64x64 map, chunk (x, y) into screenblock (x & 1) + (y & 1) * 2, wraps seamlessly.
+    WriteDefine(file, symbol, "_MAP_CHUNKS_WIDTH", (width + 31) / 32);
+    WriteDefine(file, symbol, "_MAP_CHUNKS_HEIGHT", (height + 31) / 32);
+    WriteDefine(file, symbol, "_MAP_CHUNKS", chunks.size() / SIZE_SBB_SHORTS);
+    WriteDefine(file, symbol, "_MAP_TYPE", 3, 14);
+}
+
+void Map::WriteMetamapExport(std::ostream& file, const std::string& symbol) const
+{
+    int size = metatileset->size;
+    WriteDefine(file, symbol, "_METAMAP_WIDTH", (width + size - 1) / size);
+    WriteDefine(file, symbol, "_METAMAP_HEIGHT", (height + size - 1) / size);
 }
 
 MapScene::MapScene(const std::vector<Image16Bpp>& images16, const std::string& _name, int bpp, bool affine) : Scene(_name), tileset(NULL)
@@ -187,9 +454,11 @@ MapScene::MapScene(const std::vector<Image16Bpp>& images16, const std::string& _
         ValidateMapSize(image, affine);
 
     tileset.reset(new Tileset(images16, name, bpp, affine));
+    if (params.metatile)
+        metatileset.reset(new Metatileset(name, params.metatile));
 
     for (const auto& image : images16)
-        images.emplace_back(new Map(image, tileset, affine));
+        images.emplace_back(new Map(image, tileset, affine, metatileset));
 }
 
 MapScene::MapScene(const std::vector<Image16Bpp>& images16, const std::string& _name, std::shared_ptr<Tileset>& _tileset, bool affine) : Scene(_name), tileset(_tileset)
@@ -198,6 +467,16 @@ MapScene::MapScene(const std::vector<Image16Bpp>& images16, const std::string& _
         images.emplace_back(new Map(image, tileset, affine));
 }
 
+MapScene::MapScene(const std::vector<const Image32Bpp*>& images32, const std::string& _name, int bpp) : Scene(_name)
+{
+    tileset.reset(new Tileset(ImageBands(images32), name, bpp, false));
+    if (params.metatile)
+        metatileset.reset(new Metatileset(name, params.metatile));
+
+    for (const auto& image : images32)
+        images.emplace_back(new Map(*image, tileset, metatileset));
+}
+
 const Map& MapScene::GetMap(int index) const
 {
     const Image* image = images[index].get();
@@ -209,11 +488,46 @@ const Map& MapScene::GetMap(int index) const
 void MapScene::WriteData(std::ostream& file) const
 {
     tileset->WriteData(file);
+    if (metatileset)
+        metatileset->WriteData(file);
     Scene::WriteData(file);
 }
 
 void MapScene::WriteExport(std::ostream& file) const
 {
     tileset->WriteExport(file);
+    if (metatileset)
+        metatileset->WriteExport(file);
     Scene::WriteExport(file);
 }
+
+Metatileset::Metatileset(const std::string& name, int _size) : Exportable(name), size(_size)
+{
+}
+
+int Metatileset::Add(const std::vector<unsigned short>& block)
+{
+    uint64_t key = HashBytes(block.data(), block.size() * sizeof(unsigned short));
+    int id = index.Find(key, [&](int id) {return std::equal(block.begin(), block.end(), entries.begin() + id * size * size);});
+    if (id == -1)
+    {
+        id = Size();
+        index.Insert(key, id);
+        entries.insert(entries.end(), block.begin(), block.end());
+    }
+    return id;
+}
+
+void Metatileset::WriteData(std::ostream& file) const
+{
+    WriteShortArray(file, name, "_metatiles", entries, size * size);
+    WriteNewLine(file);
+}
+
+void Metatileset::WriteExport(std::ostream& file) const
+{
+    WriteExtern(file, "const unsigned short", name, "_metatiles", entries.size());
+    WriteDefine(file, name, "_METATILES", Size());
+    WriteDefine(file, name, "_METATILE_SIZE", size);
+    WriteNewLine(file);
+}
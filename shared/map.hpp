@@ -6,10 +6,32 @@
 
 #include "image.hpp"
 #include "scene.hpp"
+#include "tile-stream.hpp"
+#include "tile.hpp"
 
 class Image16Bpp;
+class Image32Bpp;
+class ImageBands;
 class Tileset;
 
+/** Blocks of size x size map entries, palette and flip bits included, shared by the maps of a scene. Each distinct block is kept once */
+class Metatileset : public Exportable
+{
+    public:
+        Metatileset(const std::string& name, int size);
+        /** Id of the block of size x size entries, adding it if no equal block was added before */
+        int Add(const std::vector<unsigned short>& block);
+        unsigned int Size() const {return entries.size() / (size * size);}
+        void WriteData(std::ostream& file) const;
+        void WriteExport(std::ostream& file) const;
+        /** Tiles per side of a metatile */
+        int size;
+        /** Entries of each metatile row by row, metatiles in id order */
+        std::vector<unsigned short> entries;
+    private:
+        TileIndex index;
+};
+
 /** Class representing a map can be 4 or 8 bpp
   * Maps can only be 256x256 512x256 256x512 or 512x512
   * Affine map can only be 128x128, 256x256, 512x512, or 1024x1024
@@ -18,19 +40,54 @@ class Map : public Image
 {
     public:
         Map(const Image16Bpp& image, int bpp, bool affine);
-        Map(const Image16Bpp& image, std::shared_ptr<Tileset>& global_tileset, bool affine);
+        Map(const Image16Bpp& image, std::shared_ptr<Tileset>& global_tileset, bool affine, const std::shared_ptr<Metatileset>& global_metatileset = nullptr);
+        /** World maps, tiled a band of one row of tiles at a time */
+        Map(const Image32Bpp& image, int bpp);
+        Map(const Image32Bpp& image, std::shared_ptr<Tileset>& global_tileset, const std::shared_ptr<Metatileset>& global_metatileset = nullptr);
         void WriteData(std::ostream& file) const;
         void WriteCommonExport(std::ostream& file) const;
         void WriteExport(std::ostream& file) const;
+        /** Bytes of background VRAM the map takes once loaded, whole screenblocks */
+        unsigned int VramSize() const;
         std::vector<unsigned short> data;
+        /** Tile of each entry, data only has room for tile ids below 1024 and holds VRAM slots instead when streamed */
+        std::vector<int> tileIds;
         std::shared_ptr<Tileset> tileset;
+        /** Set with --metatile, the map is then exported as metamap */
+        std::shared_ptr<Metatileset> metatileset;
+        /** Metatile at each metatile position, row by row */
+        std::vector<unsigned short> metamap;
+        /** Set with --tile_stream, the entries of data then use VRAM slots instead of tile ids */
+        std::shared_ptr<TileStream> stream;
     private:
-        void Init4bpp(const Image16Bpp& image);
-        void Init8bpp(const Image16Bpp& image);
+        /** Tile matches each band of images, then splits the map into chunks, metatiles or a tile stream as asked */
+        void Init(const ImageBands& images);
+        /** Tile matches image, the band of the map starting at tile row row, gives how many tiles use the closest looking tile */
+        int Init4bpp(const Image16Bpp& image, unsigned int row);
+        int Init8bpp(const Image16Bpp& image, unsigned int row);
+        /** Matches a tile missing from the tileset to the closest looking tile, for --nearest_tile */
+        bool MatchNearest(const Image& image, const ImageTile& tile, int tilex, int tiley, int& tile_id, int& pal_id, int& flip) const;
+        /** Splits a world map into 32x32 screenblock chunks, keeping each distinct chunk once */
+        void InitChunks();
+        /** Gives each tile a VRAM slot while in view of a window scrolling over the map */
+        void InitStream();
+        /** Replaces each block of entries by its metatile in metamap */
+        void InitMetatiles();
+        /** Length of the map array exported */
+        unsigned int ExportLength() const;
         void WriteSbbData(std::ostream& file) const;
+        void WriteChunkData(std::ostream& file) const;
+        /** Writes entries, a entries_width x entries_height grid, row or column major as --map_layout says */
+        void WriteLayoutData(std::ostream& file, const std::vector<unsigned short>& entries, unsigned int entries_width, unsigned int entries_height) const;
+        void WriteChunkExport(std::ostream& file, const std::string& symbol) const;
+        void WriteMetamapExport(std::ostream& file, const std::string& symbol) const;
         void WriteAffineData(std::ostream& file) const;
         bool export_shared_info;
         bool affine;
+        /** Distinct chunks of a world map, 1024 entries each */
+        std::vector<unsigned short> chunks;
+        /** Chunk at each chunk position of a world map, row by row */
+        std::vector<unsigned short> chunkIndex;
 };
 
 /** Class representing a set of maps which use the same shared Tileset */
@@ -39,10 +96,13 @@ class MapScene : public Scene
     public:
         MapScene(const std::vector<Image16Bpp>& images, const std::string& name, int bpp, bool affine);
         MapScene(const std::vector<Image16Bpp>& images, const std::string& name, std::shared_ptr<Tileset>& tileset, bool affine);
+        /** World maps, tiled a band of one row of tiles at a time */
+        MapScene(const std::vector<const Image32Bpp*>& images, const std::string& name, int bpp);
         const Map& GetMap(int index) const;
         void WriteData(std::ostream& file) const;
         void WriteExport(std::ostream& file) const;
         std::shared_ptr<Tileset> tileset;
+        std::shared_ptr<Metatileset> metatileset;
 };
 
 #endif
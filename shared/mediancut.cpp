@@ -14,15 +14,20 @@
 #include <set>
 
 #include "dither.hpp"
+#include "export_params.hpp"
 #include "logger.hpp"
+#include "quantizer.hpp"
 
 #define L_SCALE 13              /*  scale L distances by this much  */
 #define A_SCALE 24              /*  scale a distances by this much  */
 #define B_SCALE 26              /*  and b by this much              */
 
-typedef enum {AXIS_UNDEF, AXIS_L, AXIS_B, AXIS_A} axisType;
+#define SMALL_PALETTE_MAX_PIXELS 64  /* a tile */
+#define SMALL_PALETTE_MAX_COLORS 16  /* a 4bpp palette */
+#define SMALL_PALETTE_TABLE_BITS 7
+#define SMALL_PALETTE_TABLE_SIZE (1 << SMALL_PALETTE_TABLE_BITS)
 
-typedef std::map<ColorLAB, unsigned long> FrequencyTable;
+typedef enum {AXIS_UNDEF, AXIS_L, AXIS_B, AXIS_A} axisType;
 
 class ColorRefSet
 {
@@ -51,39 +56,43 @@ class ColorRefSet
         std::map<Color16, int> references;
 };
 
+struct HistogramEntry
+{
+    HistogramEntry(const ColorLAB& _color, unsigned long _count) : color(_color), count(_count) {}
+    bool operator<(const HistogramEntry& rhs) const {return color < rhs.color;}
+    ColorLAB color;
+    unsigned long count;
+};
+
+/** Distinct LAB colors and their frequencies kept in one array sorted by color. */
 class Histogram
 {
     public:
-        Histogram(const std::vector<Color16>& imgdata = std::vector<Color16>());
-        unsigned long Size() const {return frequencies.size();}
-        bool Empty() const {return frequencies.empty();}
-        unsigned long& operator[](const ColorLAB& color) {return frequencies[color];}
-        unsigned long& operator[](const Color16& color) {return frequencies[ColorLAB(color)];}
-        void Add(const std::vector<Color16>& pixels);
-        void Remove(const ColorLAB& color) {frequencies.erase(color);}
-        bool Contains(const ColorLAB& color) const {return frequencies.find(color) != frequencies.end();}
-        void GetTotals(unsigned long& total, unsigned long& ltotal, unsigned long& atotal, unsigned long& btotal) const;
-        FrequencyTable& GetFrequencies() {return frequencies;}
-        const FrequencyTable& GetFrequencies() const {return frequencies;}
+        Histogram(const std::vector<ColorCount>& colors);
+        unsigned long Size() const {return entries.size();}
+        bool Empty() const {return entries.empty();}
+        std::vector<HistogramEntry>& GetEntries() {return entries;}
+        const std::vector<HistogramEntry>& GetEntries() const {return entries;}
         void GetColors(std::vector<Color16>& palette) const;
-        ColorLAB GetMode() const;
     private:
-        FrequencyTable frequencies;
+        std::vector<HistogramEntry> entries;
 };
 
+/** A box is the range [begin, end) of the histogram entries, boxes partition the entries in place when split */
 class Box
 {
     public:
-        Box(int lmin, int lmax, int amin, int amax, int bmin, int bmax) : Lmin(lmin), Amin(amin), Bmin(bmin), Lmax(lmax), Amax(amax), Bmax(bmax),
-            Lsplit((Lmin + Lmax + 1) / 2), Asplit((Amin + Amax + 1) / 2), Bsplit((Bmin + Bmax + 1) / 2), Lerror(0), Aerror(0), Berror(0) {}
-        Box(const Histogram& hist) : histogram(hist), Lmin(0), Amin(0), Bmin(0), Lmax(255), Amax(255), Bmax(255),
+        Box(std::vector<HistogramEntry>& _entries, size_t _begin, size_t _end, int lmin, int lmax, int amin, int amax, int bmin, int bmax) :
+            entries(&_entries), begin(_begin), end(_end), Lmin(lmin), Amin(amin), Bmin(bmin), Lmax(lmax), Amax(amax), Bmax(bmax),
             Lsplit((Lmin + Lmax + 1) / 2), Asplit((Amin + Amax + 1) / 2), Bsplit((Bmin + Bmax + 1) / 2), Lerror(0), Aerror(0), Berror(0) {}
+        Box(Histogram& hist) : Box(hist.GetEntries(), 0, hist.Size(), 0, 255, 0, 255, 0, 255) {}
 
         void Update(int boxes_left);
         const Color& GetColor() const {return color;}
         void Split(Box& box, axisType which_axis);
 
-        Histogram histogram;
+        std::vector<HistogramEntry>* entries;
+        size_t begin, end;
         int Lmin, Amin, Bmin;
         int Lmax, Amax, Bmax;
         int Lsplit, Asplit, Bsplit;
@@ -92,28 +101,45 @@ class Box
         void UpdateError();
         void UpdateSplits(int boxes_left);
         void UpdateColor();
+        void GetTotals(unsigned long& total, unsigned long& ltotal, unsigned long& atotal, unsigned long& btotal) const;
+        const HistogramEntry* First() const {return entries->data() + begin;}
+        const HistogramEntry* Last() const {return entries->data() + end;}
         ColorLAB labColor;
         Color color;
 };
 
-Histogram::Histogram(const std::vector<Color16>& imgdata)
+Histogram::Histogram(const std::vector<ColorCount>& colors)
 {
-    for (const auto& color : imgdata)
-        frequencies[ColorLAB(color)]++;
+    entries.reserve(colors.size());
+    for (const auto& color_count : colors)
+        entries.emplace_back(ColorLAB(color_count.color), color_count.count);
+
+    // Many Color16s may convert to the same LAB color, merge them.
+    std::sort(entries.begin(), entries.end());
+    unsigned int last = 0;
+    for (unsigned int i = 1; i < entries.size(); i++)
+    {
+        if (entries[i].color == entries[last].color)
+            entries[last].count += entries[i].count;
+        else
+            entries[++last] = entries[i];
+    }
+    if (!entries.empty())
+        entries.erase(entries.begin() + last + 1, entries.end());
 }
 
-void Histogram::Add(const std::vector<Color16>& pixels)
+void Histogram::GetColors(std::vector<Color16>& colors) const
 {
-    for (const auto& color : pixels)
-        frequencies[ColorLAB(color)]++;
+    for (const auto& entry : entries)
+        colors.push_back(Color16(entry.color));
 }
 
-void Histogram::GetTotals(unsigned long& total, unsigned long& ltotal, unsigned long& atotal, unsigned long& btotal) const
+void Box::GetTotals(unsigned long& total, unsigned long& ltotal, unsigned long& atotal, unsigned long& btotal) const
 {
-    for (const auto& color_freq : frequencies)
+    for (const HistogramEntry* entry = First(); entry != Last(); ++entry)
     {
-        const auto& color = color_freq.first;
-        unsigned long this_freq = color_freq.second;
+        const auto& color = entry->color;
+        unsigned long this_freq = entry->count;
 
         ltotal += color.l * this_freq;
         atotal += color.a * this_freq;
@@ -122,12 +148,6 @@ void Histogram::GetTotals(unsigned long& total, unsigned long& ltotal, unsigned
     }
 }
 
-void Histogram::GetColors(std::vector<Color16>& colors) const
-{
-    for (const auto& color_freq : frequencies)
-        colors.push_back(Color16(color_freq.first));
-}
-
 void Box::Update(int boxes_left)
 {
     // Swap so that the mins and maxes will change after the for loop.
@@ -135,9 +155,9 @@ void Box::Update(int boxes_left)
     std::swap(Amin, Amax);
     std::swap(Bmin, Bmax);
 
-    for (const auto& color_freq : histogram.GetFrequencies())
+    for (const HistogramEntry* entry = First(); entry != Last(); ++entry)
     {
-        const auto& color = color_freq.first;
+        const auto& color = entry->color;
         Lmin = std::min(color.l, Lmin);
         Lmax = std::max(color.l, Lmax);
         Amin = std::min(color.a, Amin);
@@ -159,10 +179,10 @@ void Box::UpdateError()
     Aerror = 0;
     Berror = 0;
 
-    for (const auto& color_freq : histogram.GetFrequencies())
+    for (const HistogramEntry* entry = First(); entry != Last(); ++entry)
     {
-        const auto& color = color_freq.first;
-        unsigned long freq_here = color_freq.second;
+        const auto& color = entry->color;
+        unsigned long freq_here = entry->count;
 
         Lerror += freq_here * (c.l - color.l) * (c.l - color.l);
         Aerror += freq_here * (c.a - color.a) * (c.a - color.a);
@@ -194,7 +214,7 @@ void Box::UpdateColor()
     unsigned long atotal = 0;
     unsigned long btotal = 0;
 
-    histogram.GetTotals(total, ltotal, atotal, btotal);
+    GetTotals(total, ltotal, atotal, btotal);
 
     double l = (double)ltotal / total;
     double a = (double)atotal / total;
@@ -231,66 +251,94 @@ void Box::Split(Box& b2, axisType which_axis)
             FatalLog("Internal error incorrect axis %d, this shouldn't happen", which_axis);
     }
 
-    std::vector<ColorLAB> del;
-    for (const auto& color_freq : histogram.GetFrequencies())
+    // Colors outside of this box move to the back of the range which becomes b2.
+    auto first = entries->begin() + begin;
+    auto last = entries->begin() + end;
+    auto middle = std::partition(first, last, [this](const HistogramEntry& entry)
     {
-        const auto& color = color_freq.first;
-        if (color.l > Lmax || color.a > Amax || color.b > Bmax)
-        {
-            b2.histogram[color] = color_freq.second;
-            del.push_back(color);
-        }
-    }
-
-    for (const auto& color : del)
-        histogram.Remove(color);
+        const auto& color = entry.color;
+        return !(color.l > Lmax || color.a > Amax || color.b > Bmax);
+    });
+
+    b2.entries = entries;
+    b2.begin = middle - entries->begin();
+    b2.end = end;
+    end = b2.begin;
 }
 
 #define BIAS_FACTOR 2.66
 #define BIAS_NUMBER 2.0
-static Box* find_split_candidate(const std::list<Box>& boxlist, const int desired_colors, axisType *which_axis)
+static double get_lbias(size_t numboxes, const int desired_colors)
 {
-    Box* which = NULL;
+    if (desired_colors > 16)
+        return 1.0F;
+    return (numboxes > BIAS_NUMBER) ? 1.0F : (BIAS_NUMBER - numboxes + 1) * BIAS_FACTOR / BIAS_NUMBER;
+}
+
+/** Checks if box has an axis with more error than maxc, if so updates maxc and which_axis */
+static bool update_split_candidate(const Box& box, double Lbias, double& maxc, axisType *which_axis)
+{
+    bool found = false;
+    double lpe = box.Lerror * Lbias;
+    double ape = box.Aerror;
+    double bpe = box.Berror;
+    if (lpe > maxc && box.Lmin < box.Lmax)
+    {
+        found = true;
+        maxc = Lbias * lpe;
+        *which_axis = AXIS_L;
+    }
+
+    if (ape > maxc && box.Amin < box.Amax)
+    {
+        found = true;
+        maxc = ape;
+        *which_axis = AXIS_A;
+    }
 
-    double Lbias = 1.0F;
-    if (desired_colors <= 16)
+    if (bpe > maxc && box.Bmin < box.Bmax)
     {
-        double numboxes = boxlist.size();
-        Lbias = (numboxes > BIAS_NUMBER) ? 1.0F : (BIAS_NUMBER - numboxes + 1) * BIAS_FACTOR / BIAS_NUMBER;
+        found = true;
+        maxc = bpe;
+        *which_axis = AXIS_B;
     }
 
+    return found;
+}
+
+static Box* find_split_candidate(const std::vector<Box>& boxlist, const int desired_colors, axisType *which_axis)
+{
+    Box* which = NULL;
+
+    double Lbias = get_lbias(boxlist.size(), desired_colors);
+
     double maxc = 0;
     *which_axis = AXIS_UNDEF;
     for (auto& box : boxlist)
     {
-        double lpe = box.Lerror * Lbias;
-        double ape = box.Aerror;
-        double bpe = box.Berror;
-        if (lpe > maxc && box.Lmin < box.Lmax)
-        {
-            which = const_cast<Box*>(&box);
-            maxc = Lbias * lpe;
-            *which_axis = AXIS_L;
-        }
-
-        if (ape > maxc && box.Amin < box.Amax)
-        {
+        if (update_split_candidate(box, Lbias, maxc, which_axis))
             which = const_cast<Box*>(&box);
-            maxc = ape;
-            *which_axis = AXIS_A;
-        }
-
-        if (bpe > maxc && box.Bmin < box.Bmax)
-        {
-            which = const_cast<Box*>(&box);
-            maxc = bpe;
-            *which_axis = AXIS_B;
-        }
     }
 
     return which;
 }
 
+/** Entry in MedianCut's max heap of boxes keyed by their largest axis error */
+struct SplitCandidate
+{
+    SplitCandidate(double _error, size_t _box, axisType _axis) : error(_error), box(_box), axis(_axis) {}
+    bool operator<(const SplitCandidate& rhs) const
+    {
+        // On ties the box created first wins, same as find_split_candidate.
+        if (error != rhs.error)
+            return error < rhs.error;
+        return box > rhs.box;
+    }
+    double error;
+    size_t box;
+    axisType axis;
+};
+
 // From https://en.wikipedia.org/wiki/Relative_luminance
 #define LUMINANCE(r, g, b) (0.2126 * (r) + 0.7152 * (g) + 0.0722 * (b))
 
@@ -303,6 +351,7 @@ class PaletteSort
         }
 };
 
+// Reorders the entries of hist as the boxes are split.
 void MedianCut(Histogram& hist, unsigned int desired_colors, std::vector<Color16>& palette)
 {
     EventLog l(__func__);
@@ -317,7 +366,8 @@ void MedianCut(Histogram& hist, unsigned int desired_colors, std::vector<Color16
     VerboseLog("Running palette generating algorithm since we found %zd colors. Reducing to %zd colors", hist.Size(), desired_colors);
 
     ColorRefSet refset;
-    std::list<Box> boxlist;
+    std::vector<Box> boxlist;
+    boxlist.reserve(desired_colors + 1);
 
     boxlist.emplace_back(hist);
     Box& first = boxlist.back();
@@ -325,17 +375,52 @@ void MedianCut(Histogram& hist, unsigned int desired_colors, std::vector<Color16
 
     refset.Ref(first.GetColor());
 
+    // While Lbias is in effect the choice depends on all boxes at once, so scan them.
+    // Afterwards keep the boxes that can still be split in a heap.
+    std::priority_queue<SplitCandidate> candidates;
+    bool use_heap = false;
+    auto push_candidate = [&](size_t index)
+    {
+        double maxc = 0;
+        axisType which_axis = AXIS_UNDEF;
+        if (update_split_candidate(boxlist[index], 1.0F, maxc, &which_axis))
+            candidates.emplace(maxc, index, which_axis);
+    };
+
     // Each step we are adding either 0, 1, or 2 colors
     while (refset.Size() < desired_colors)
     {
         axisType which_axis;
+        size_t index;
 
-        Box* b = find_split_candidate(boxlist, desired_colors, &which_axis);
-        if (b == NULL)
-            break;
+        if (get_lbias(boxlist.size(), desired_colors) != 1.0F)
+        {
+            Box* b = find_split_candidate(boxlist, desired_colors, &which_axis);
+            if (b == NULL)
+                break;
+            index = b - boxlist.data();
+        }
+        else
+        {
+            if (!use_heap)
+            {
+                for (size_t i = 0; i < boxlist.size(); i++)
+                    push_candidate(i);
+                use_heap = true;
+            }
+
+            if (candidates.empty())
+                break;
 
-        Box& b1 = *b;
-        boxlist.emplace_back(b1.Lmin, b1.Lmax, b1.Amin, b1.Amax, b1.Bmin, b1.Bmax);
+            const SplitCandidate& candidate = candidates.top();
+            index = candidate.box;
+            which_axis = candidate.axis;
+            candidates.pop();
+        }
+
+        const Box& b = boxlist[index];
+        boxlist.push_back(Box(*b.entries, b.end, b.end, b.Lmin, b.Lmax, b.Amin, b.Amax, b.Bmin, b.Bmax));
+        Box& b1 = boxlist[index];
         Box& b2 = boxlist.back();
         refset.Deref(b1.GetColor());
 
@@ -346,6 +431,12 @@ void MedianCut(Histogram& hist, unsigned int desired_colors, std::vector<Color16
 
         refset.Ref(b1.GetColor());
         refset.Ref(b2.GetColor());
+
+        if (use_heap)
+        {
+            push_candidate(index);
+            push_candidate(boxlist.size() - 1);
+        }
     }
 
     refset.GetColors(palette);
@@ -353,22 +444,29 @@ void MedianCut(Histogram& hist, unsigned int desired_colors, std::vector<Color16
     palette.resize(desired_colors);
 }
 
-void GetPalette(const std::vector<Color16>& pixels, unsigned int num_colors, const Color16& transparent, unsigned int offset, Palette& palette)
+void MedianCutQuantizer::Quantize(const std::vector<ColorCount>& colors, unsigned int num_colors, std::vector<Color16>& palette) const
 {
-    EventLog l(__func__);
-
-    Histogram hist(pixels);
+    Histogram hist(colors);
+    MedianCut(hist, num_colors, palette);
+}
 
+static void GetPalette(std::vector<ColorCount>& colors, unsigned int num_colors, const Color16& transparent, unsigned int offset, Palette& palette)
+{
     std::vector<Color16> paletteArray;
     paletteArray.reserve(num_colors);
 
     if (!offset)
     {
         num_colors = std::max(1U, num_colors - 1);
-        hist.Remove(ColorLAB(transparent));
+        // Anything indistinguishable from the transparent color gets it.
+        ColorLAB lab_transparent(transparent);
+        colors.erase(std::remove_if(colors.begin(), colors.end(), [&lab_transparent](const ColorCount& color_count)
+        {
+            return ColorLAB(color_count.color) == lab_transparent;
+        }), colors.end());
     }
 
-    MedianCut(hist, num_colors, paletteArray);
+    CreateQuantizer(params.quantizer)->Quantize(colors, num_colors, paletteArray);
 
     std::sort(paletteArray.begin(), paletteArray.end(), PaletteSort());
     if (!offset)
@@ -381,50 +479,140 @@ void GetPalette(const std::vector<Color16>& pixels, unsigned int num_colors, con
     }
 
     palette.Set(paletteArray);
+    VerboseLog("palette array size %d num_colors %d", paletteArray.size(), num_colors);
 }
 
-void GetPalette(const Image16Bpp& image, unsigned int num_colors, const Color16& transparent, unsigned int offset, Palette& palette)
+/** Fixed size set of the distinct colors of a small input, open addressed on Color16::ToIndex */
+class SmallColorSet
 {
-    GetPalette(image.pixels, num_colors, transparent, offset, palette);
-}
+    public:
+        SmallColorSet() : size(0) {memset(slots, 0, sizeof(slots));}
+        void Add(const Color16& color)
+        {
+            // Keys are stored + 1 so 0 marks an empty slot.
+            unsigned short key = color.ToIndex() + 1;
+            unsigned int slot = (key * 2654435761U) >> (32 - SMALL_PALETTE_TABLE_BITS);
+            while (slots[slot] && slots[slot] != key)
+                slot = (slot + 1) & (SMALL_PALETTE_TABLE_SIZE - 1);
+            if (!slots[slot])
+            {
+                slots[slot] = key;
+                colors[size++] = color;
+            }
+        }
+        unsigned int Size() const {return size;}
+        const Color16& At(unsigned int i) const {return colors[i];}
+    private:
+        unsigned short slots[SMALL_PALETTE_TABLE_SIZE];
+        Color16 colors[SMALL_PALETTE_MAX_PIXELS];
+        unsigned int size;
+};
 
-void GetPalette(const std::vector<Image16Bpp>& images, unsigned int num_colors, const Color16& transparent, unsigned int offset, Palette& palette)
+/** Builds the palette for a handful of pixels without going through a Quantizer.
+  * The result is the same as median cut which would keep every color.
+  * Returns false if the pixels have more colors than fit, leaving palette untouched. */
+static bool GetSmallPalette(const std::vector<Color16>& pixels, unsigned int num_colors, const Color16& transparent, Palette& palette)
 {
-    EventLog l(__func__);
+    if (pixels.size() > SMALL_PALETTE_MAX_PIXELS || num_colors > SMALL_PALETTE_MAX_COLORS || num_colors < 2)
+        return false;
+    if (!params.quantizer.empty() && params.quantizer != "mediancut")
+        return false;
 
-    Histogram hist;
-    for (const auto& image : images)
-        hist.Add(image.pixels);
+    SmallColorSet distinct;
+    for (const auto& color : pixels)
+        distinct.Add(color);
+
+    // Same as the histogram, drop what matches the transparent color and merge colors with the same LAB color.
+    const unsigned int desired_colors = num_colors - 1;
+    ColorLAB lab_transparent(transparent);
+    ColorLAB labs[SMALL_PALETTE_MAX_PIXELS];
+    unsigned int num_labs = 0;
+    for (unsigned int i = 0; i < distinct.Size(); i++)
+    {
+        ColorLAB lab(distinct.At(i));
+        if (lab != lab_transparent)
+            labs[num_labs++] = lab;
+    }
+    std::sort(labs, labs + num_labs);
+    num_labs = std::unique(labs, labs + num_labs) - labs;
+
+    if (num_labs == 0 || num_labs > desired_colors)
+        return false;
+
+    // MedianCut lists the histogram colors then the colors of its boxes, which here each hold one color.
+    Color16 converted[SMALL_PALETTE_MAX_COLORS];
+    for (unsigned int i = 0; i < num_labs; i++)
+        converted[i] = Color16(labs[i]);
 
     std::vector<Color16> paletteArray;
     paletteArray.reserve(num_colors);
+    paletteArray.insert(paletteArray.end(), converted, converted + num_labs);
 
-    if (!offset)
-    {
-        num_colors = std::max(1U, num_colors - 1);
-        hist.Remove(ColorLAB(transparent));
-    }
-
-    MedianCut(hist, num_colors, paletteArray);
+    std::sort(converted, converted + num_labs);
+    unsigned int num_box_colors = std::unique(converted, converted + num_labs) - converted;
+    // Box colors went through a Color without alpha.
+    for (unsigned int i = 0; i < num_box_colors && paletteArray.size() < desired_colors; i++)
+        paletteArray.push_back(Color16(converted[i].r, converted[i].g, converted[i].b));
+    paletteArray.resize(desired_colors);
 
     std::sort(paletteArray.begin(), paletteArray.end(), PaletteSort());
-    if (!offset)
-    {
-        const auto& it = std::find(paletteArray.begin(), paletteArray.end(), transparent);
-        if (it == paletteArray.end())
-            paletteArray.insert(paletteArray.begin(), transparent);
-        else
-            std::swap(*paletteArray.begin(), *it);
-    }
+    const auto& it = std::find(paletteArray.begin(), paletteArray.end(), transparent);
+    if (it == paletteArray.end())
+        paletteArray.insert(paletteArray.begin(), transparent);
+    else
+        std::swap(*paletteArray.begin(), *it);
 
     palette.Set(paletteArray);
-    VerboseLog("palette array size %d num_colors %d", paletteArray.size(), num_colors);
+    return true;
+}
+
+void GetPalette(const std::vector<Color16>& pixels, unsigned int num_colors, const Color16& transparent, unsigned int offset, Palette& palette)
+{
+    // Per tile palettes skip the color counting and timers below.
+    if (!offset && GetSmallPalette(pixels, num_colors, transparent, palette))
+        return;
+
+    EventLog l(__func__);
+
+    std::vector<ColorCount> colors;
+    CountColors(pixels, colors);
+    GetPalette(colors, num_colors, transparent, offset, palette);
+}
+
+void GetPalette(const Image16Bpp& image, unsigned int num_colors, const Color16& transparent, unsigned int offset, Palette& palette)
+{
+    GetPalette(image.pixels, num_colors, transparent, offset, palette);
+}
+
+void GetPalette(const std::vector<Image16Bpp>& images, unsigned int num_colors, const Color16& transparent, unsigned int offset, Palette& palette)
+{
+    EventLog l(__func__);
+
+    std::vector<ColorCount> colors;
+    for (const auto& image : images)
+        CountColors(image.pixels, colors);
+    GetPalette(colors, num_colors, transparent, offset, palette);
+}
+
+void GetPalette(const ImageBands& images, unsigned int num_colors, const Color16& transparent, unsigned int offset, Palette& palette)
+{
+    EventLog l(__func__);
+
+    std::vector<ColorCount> colors;
+    for (unsigned int i = 0; i < images.Size(); i++)
+        CountColors(images.Get(i).pixels, colors);
+    GetPalette(colors, num_colors, transparent, offset, palette);
 }
 
 void DitherAndReduceImage(const Image16Bpp& image, const Color16& transparent, bool dither, double dither_level, unsigned int offset, Image8Bpp& indexedImage)
 {
     EventLog l(__func__);
-    RiemersmaDither(image, indexedImage, transparent, dither, dither_level);
+    if (dither && params.dither_mode == "ordered")
+        OrderedDither(image, indexedImage, transparent, params.dither_matrix, dither_level);
+    else if (dither && !params.dither_mode.empty() && params.dither_mode != "riemersma")
+        ErrorDiffusionDither(image, indexedImage, transparent, params.dither_mode, dither_level);
+    else
+        RiemersmaDither(image, indexedImage, transparent, dither, dither_level);
     if (offset > 0)
     {
         for (unsigned int i = 0; i < indexedImage.pixels.size(); i++)
@@ -0,0 +1,186 @@
+#include "quantizer.hpp"
+
+#include <algorithm>
+
+#include "logger.hpp"
+
+// Color16 components are 5 bits so the tree is 5 levels deep, nodes at level 5 are always leaves.
+#define OCTREE_DEPTH 5
+
+struct OctreeNode
+{
+    unsigned long count;
+    unsigned long r, g, b;
+    int children[8];
+    int next_reducible;
+    bool leaf;
+};
+
+/** Octree that folds the deepest reducible node into its parent whenever it holds more than max_leaves leaves */
+class Octree
+{
+    public:
+        Octree(unsigned int max_leaves);
+        void Insert(const ColorCount& color_count);
+        void GetColors(std::vector<Color16>& palette) const;
+    private:
+        int NewNode(int level);
+        void FreeNode(int index);
+        void Reduce();
+        void GetColors(int index, std::vector<Color16>& palette) const;
+        std::vector<OctreeNode> nodes;
+        std::vector<int> free_nodes;
+        /** Linked lists of non leaf nodes for each level */
+        int reducible[OCTREE_DEPTH];
+        unsigned int leaves;
+        unsigned int max_leaves;
+        int root;
+};
+
+Octree::Octree(unsigned int _max_leaves) : leaves(0), max_leaves(_max_leaves)
+{
+    std::fill(reducible, reducible + OCTREE_DEPTH, -1);
+    root = NewNode(0);
+}
+
+int Octree::NewNode(int level)
+{
+    int index;
+    if (!free_nodes.empty())
+    {
+        index = free_nodes.back();
+        free_nodes.pop_back();
+    }
+    else
+    {
+        index = nodes.size();
+        nodes.emplace_back();
+    }
+
+    OctreeNode& node = nodes[index];
+    node.count = node.r = node.g = node.b = 0;
+    std::fill(node.children, node.children + 8, -1);
+    node.leaf = level == OCTREE_DEPTH;
+    node.next_reducible = -1;
+    if (node.leaf)
+    {
+        leaves++;
+    }
+    else
+    {
+        node.next_reducible = reducible[level];
+        reducible[level] = index;
+    }
+    return index;
+}
+
+void Octree::FreeNode(int index)
+{
+    free_nodes.push_back(index);
+}
+
+void Octree::Insert(const ColorCount& color_count)
+{
+    const Color16& color = color_count.color;
+    int r = color.r & 0x1F;
+    int g = color.g & 0x1F;
+    int b = color.b & 0x1F;
+
+    int index = root;
+    for (int level = 0; !nodes[index].leaf; level++)
+    {
+        int shift = OCTREE_DEPTH - 1 - level;
+        int child = ((r >> shift) & 1) << 2 | ((g >> shift) & 1) << 1 | ((b >> shift) & 1);
+        if (nodes[index].children[child] == -1)
+        {
+            // NewNode may reallocate nodes.
+            int new_node = NewNode(level + 1);
+            nodes[index].children[child] = new_node;
+        }
+        index = nodes[index].children[child];
+    }
+
+    OctreeNode& leaf = nodes[index];
+    leaf.count += color_count.count;
+    leaf.r += r * color_count.count;
+    leaf.g += g * color_count.count;
+    leaf.b += b * color_count.count;
+
+    while (leaves > max_leaves)
+        Reduce();
+}
+
+void Octree::Reduce()
+{
+    int level = OCTREE_DEPTH - 1;
+    while (level > 0 && reducible[level] == -1)
+        level--;
+
+    // The root can't be removed from the list; reducing it leaves a single color.
+    int index = reducible[level];
+    if (level > 0)
+        reducible[level] = nodes[index].next_reducible;
+    else
+        reducible[0] = -1;
+
+    OctreeNode& node = nodes[index];
+    unsigned int children = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        int child = node.children[i];
+        if (child == -1)
+            continue;
+        node.count += nodes[child].count;
+        node.r += nodes[child].r;
+        node.g += nodes[child].g;
+        node.b += nodes[child].b;
+        node.children[i] = -1;
+        FreeNode(child);
+        children++;
+    }
+    node.leaf = true;
+    leaves = leaves - children + 1;
+}
+
+void Octree::GetColors(std::vector<Color16>& palette) const
+{
+    GetColors(root, palette);
+}
+
+void Octree::GetColors(int index, std::vector<Color16>& palette) const
+{
+    const OctreeNode& node = nodes[index];
+    if (node.leaf)
+    {
+        if (!node.count)
+            return;
+        int r = (node.r + node.count / 2) / node.count;
+        int g = (node.g + node.count / 2) / node.count;
+        int b = (node.b + node.count / 2) / node.count;
+        Color16 color(r, g, b);
+        if (std::find(palette.begin(), palette.end(), color) == palette.end())
+            palette.push_back(color);
+        return;
+    }
+
+    for (int i = 0; i < 8; i++)
+    {
+        if (node.children[i] != -1)
+            GetColors(node.children[i], palette);
+    }
+}
+
+void OctreeQuantizer::Quantize(const std::vector<ColorCount>& colors, unsigned int num_colors, std::vector<Color16>& palette) const
+{
+    EventLog l(__func__);
+
+    if (colors.empty() || num_colors == 0)
+        return;
+
+    Octree tree(num_colors);
+    for (const auto& color_count : colors)
+        tree.Insert(color_count);
+
+    tree.GetColors(palette);
+    VerboseLog("Octree quantizer found %d colors for %d colors", (int)palette.size(), num_colors);
+}
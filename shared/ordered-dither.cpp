@@ -0,0 +1,267 @@
+#include "dither.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "logger.hpp"
+#include "shared.hpp"
+
+#define BLUE_NOISE_SIZE 32
+#define BLUE_NOISE_SIGMA 1.5
+/* Offsets are stored biased so per byte adds never go negative */
+#define OFFSET_BIAS 16
+
+/** Threshold matrix, ranks from 0 to size * size - 1 */
+struct ThresholdMatrix
+{
+    ThresholdMatrix(unsigned int _size) : size(_size), ranks(_size * _size) {}
+    unsigned int size;
+    std::vector<unsigned int> ranks;
+};
+
+static ThresholdMatrix BayerMatrix(unsigned int size)
+{
+    ThresholdMatrix matrix(1);
+    while (matrix.size < size)
+    {
+        // M(2n) = [4M, 4M + 2; 4M + 3, 4M + 1]
+        unsigned int n = matrix.size;
+        ThresholdMatrix next(n * 2);
+        for (unsigned int y = 0; y < n; y++)
+        {
+            for (unsigned int x = 0; x < n; x++)
+            {
+                unsigned int rank = matrix.ranks[y * n + x] * 4;
+                next.ranks[y * 2 * n + x] = rank;
+                next.ranks[y * 2 * n + x + n] = rank + 2;
+                next.ranks[(y + n) * 2 * n + x] = rank + 3;
+                next.ranks[(y + n) * 2 * n + x + n] = rank + 1;
+            }
+        }
+        matrix = next;
+    }
+    return matrix;
+}
+
+/** Blue noise matrix from Ulichney's void and cluster method, with every rank after the initial pattern placed in the largest void. */
+static ThresholdMatrix BlueNoiseMatrix()
+{
+    const int n = BLUE_NOISE_SIZE;
+    const int cells = n * n;
+
+    // Gaussian energy on a torus indexed by (dx, dy).
+    std::vector<double> kernel(cells);
+    for (int dy = 0; dy < n; dy++)
+    {
+        for (int dx = 0; dx < n; dx++)
+        {
+            int x = std::min(dx, n - dx);
+            int y = std::min(dy, n - dy);
+            kernel[dy * n + dx] = exp(-(x * x + y * y) / (2 * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+        }
+    }
+
+    std::vector<bool> pattern(cells);
+    std::vector<double> energy(cells);
+    auto toggle = [&](int cell, bool value)
+    {
+        pattern[cell] = value;
+        int cx = cell % n, cy = cell / n;
+        double sign = value ? 1 : -1;
+        for (int y = 0; y < n; y++)
+        {
+            for (int x = 0; x < n; x++)
+                energy[y * n + x] += sign * kernel[((y - cy + n) % n) * n + (x - cx + n) % n];
+        }
+    };
+    auto tightest_cluster = [&]()
+    {
+        int best = -1;
+        for (int i = 0; i < cells; i++)
+            if (pattern[i] && (best == -1 || energy[i] > energy[best])) best = i;
+        return best;
+    };
+    auto largest_void = [&]()
+    {
+        int best = -1;
+        for (int i = 0; i < cells; i++)
+            if (!pattern[i] && (best == -1 || energy[i] < energy[best])) best = i;
+        return best;
+    };
+
+    // Initial pattern of about a tenth of the cells, relaxed until stable.
+    unsigned int seed = 1;
+    int ones = 0;
+    while (ones < cells / 10)
+    {
+        seed = seed * 1103515245 + 12345;
+        int cell = (seed >> 16) % cells;
+        if (pattern[cell]) continue;
+        toggle(cell, true);
+        ones++;
+    }
+    for (int i = 0; i < cells; i++)
+    {
+        int cluster = tightest_cluster();
+        toggle(cluster, false);
+        int empty = largest_void();
+        toggle(empty, true);
+        if (cluster == empty) break;
+    }
+
+    ThresholdMatrix matrix(n);
+    std::vector<bool> initial = pattern;
+    std::vector<double> initial_energy = energy;
+    for (int rank = ones - 1; rank >= 0; rank--)
+    {
+        int cluster = tightest_cluster();
+        toggle(cluster, false);
+        matrix.ranks[cluster] = rank;
+    }
+
+    pattern = initial;
+    energy = initial_energy;
+    for (int rank = ones; rank < cells; rank++)
+    {
+        int empty = largest_void();
+        toggle(empty, true);
+        matrix.ranks[empty] = rank;
+    }
+
+    return matrix;
+}
+
+static const ThresholdMatrix& GetThresholdMatrix(const std::string& name)
+{
+    static const ThresholdMatrix bayer4 = BayerMatrix(4);
+    static const ThresholdMatrix bayer8 = BayerMatrix(8);
+    if (name == "bayer4")
+        return bayer4;
+    if (name == "bluenoise")
+    {
+        static const ThresholdMatrix bluenoise = BlueNoiseMatrix();
+        return bluenoise;
+    }
+    return bayer8;
+}
+
+static inline uint32_t PackOffset(int offset)
+{
+    // Color16 is laid out as a, r, g, b bytes, a is left alone.
+    uint32_t biased = offset + OFFSET_BIAS;
+    return biased << 8 | biased << 16 | biased << 24;
+}
+
+/** Perturbs width pixels by the biased offsets and writes the Color16::ToIndex of the perturbed and original colors. */
+static void PerturbRow(const Color16* pixels, const uint32_t* offsets, unsigned int width, uint32_t* keys, uint32_t* original_keys)
+{
+    static_assert(sizeof(Color16) == 4, "Color16 must be 4 packed bytes");
+    unsigned int x = 0;
+
+#if defined(__AVX2__)
+    const __m256i bias = _mm256_set1_epi8(OFFSET_BIAS);
+    const __m256i max = _mm256_set1_epi8(OFFSET_BIAS + 31);
+    const __m256i mask_r = _mm256_set1_epi32(0x1F);
+    const __m256i mask_g = _mm256_set1_epi32(0x3E0);
+    const __m256i mask_b = _mm256_set1_epi32(0x7C00);
+    for (; x + 8 <= width; x += 8)
+    {
+        __m256i color = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + x));
+        __m256i offset = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets + x));
+        __m256i perturbed = _mm256_add_epi8(color, offset);
+        perturbed = _mm256_sub_epi8(_mm256_min_epu8(_mm256_max_epu8(perturbed, bias), max), bias);
+
+        __m256i key = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(perturbed, 8), mask_r),
+                      _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(perturbed, 11), mask_g),
+                                      _mm256_and_si256(_mm256_srli_epi32(perturbed, 14), mask_b)));
+        __m256i original = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(color, 8), mask_r),
+                           _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(color, 11), mask_g),
+                                           _mm256_and_si256(_mm256_srli_epi32(color, 14), mask_b)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(keys + x), key);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(original_keys + x), original);
+    }
+#elif defined(__SSE2__)
+    const __m128i bias = _mm_set1_epi8(OFFSET_BIAS);
+    const __m128i max = _mm_set1_epi8(OFFSET_BIAS + 31);
+    const __m128i mask_r = _mm_set1_epi32(0x1F);
+    const __m128i mask_g = _mm_set1_epi32(0x3E0);
+    const __m128i mask_b = _mm_set1_epi32(0x7C00);
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i color = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x));
+        __m128i offset = _mm_loadu_si128(reinterpret_cast<const __m128i*>(offsets + x));
+        __m128i perturbed = _mm_add_epi8(color, offset);
+        perturbed = _mm_sub_epi8(_mm_min_epu8(_mm_max_epu8(perturbed, bias), max), bias);
+
+        __m128i key = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(perturbed, 8), mask_r),
+                      _mm_or_si128(_mm_and_si128(_mm_srli_epi32(perturbed, 11), mask_g),
+                                   _mm_and_si128(_mm_srli_epi32(perturbed, 14), mask_b)));
+        __m128i original = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(color, 8), mask_r),
+                           _mm_or_si128(_mm_and_si128(_mm_srli_epi32(color, 11), mask_g),
+                                        _mm_and_si128(_mm_srli_epi32(color, 14), mask_b)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(keys + x), key);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(original_keys + x), original);
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        const Color16& color = pixels[x];
+        int offset = (offsets[x] >> 8 & 0xFF) - OFFSET_BIAS;
+        int r = std::max(0, std::min(31, color.r + offset));
+        int g = std::max(0, std::min(31, color.g + offset));
+        int b = std::max(0, std::min(31, color.b + offset));
+        keys[x] = r | g << 5 | b << 10;
+        original_keys[x] = color.ToIndex();
+    }
+}
+
+void OrderedDither(const Image16Bpp& inImage, Image8Bpp& outImage, const Color16& transparent, const std::string& matrix_name, float ditherlevel)
+{
+    const ThresholdMatrix& matrix = GetThresholdMatrix(matrix_name);
+    const unsigned int size = matrix.size;
+    const unsigned int width = inImage.width;
+    const unsigned int height = inImage.height;
+    const Palette& palette = *outImage.palette;
+
+    // Thresholds spread over ditherlevel of the 32 levels of a component, centered on 0.
+    const double spread = ditherlevel * 32;
+    std::vector<uint32_t> offsets(size * width);
+    for (unsigned int y = 0; y < size; y++)
+    {
+        for (unsigned int x = 0; x < width; x++)
+        {
+            double threshold = (matrix.ranks[y * size + x % size] + 0.5) / (size * size) - 0.5;
+            int offset = (int)round(threshold * spread);
+            offsets[y * width + x] = PackOffset(std::max(-OFFSET_BIAS, std::min(OFFSET_BIAS, offset)));
+        }
+    }
+
+    // Rows don't depend on each other, so several threads map them at once.
+    if (height > 1)
+        palette.FillColormap();
+
+    const unsigned short transparent_key = transparent.ToIndex();
+    ParallelFor(height, [&](unsigned int y)
+    {
+        std::vector<uint32_t> keys(width);
+        std::vector<uint32_t> original_keys(width);
+        PerturbRow(inImage.pixels.data() + y * width, offsets.data() + (y % size) * width, width, keys.data(), original_keys.data());
+
+        unsigned char* out = outImage.pixels.data() + y * width;
+        for (unsigned int x = 0; x < width; x++)
+        {
+            unsigned int key = keys[x];
+            out[x] = original_keys[x] == transparent_key ? 0 : palette.Search(Color16(key & 0x1F, key >> 5 & 0x1F, key >> 10 & 0x1F));
+        }
+    });
+}
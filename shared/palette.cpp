@@ -7,8 +7,13 @@
 #include "fileutils.hpp"
 #include "shared.hpp"
 
-ColorArray::ColorArray(const std::vector<Color16>& _colors) : colors(_colors), colorSet(colors.begin(), colors.end())
+#define COLORMAP_PAGES 32
+#define COLORMAP_PAGE_SIZE (COLOR16_COUNT / COLORMAP_PAGES)
+
+ColorArray::ColorArray(const std::vector<Color16>& _colors) : colors(_colors)
 {
+    for (const auto& color : colors)
+        colorSet.Insert(color);
     labColors.reserve(colors.size());
     for (const auto& color : colors)
         labColors.push_back(ColorLAB(color));
@@ -18,19 +23,21 @@ void ColorArray::Clear()
 {
     labColors.clear();
     colors.clear();
-    colorSet.clear();
-    paletteEntryStats.clear();
-    colorEntryStats.clear();
+    colorSet.Clear();
+    InvalidateColormap();
 }
 
 void ColorArray::Set(const std::vector<Color16>& _colors)
 {
     colors = _colors;
-    colorSet.clear();
-    colorSet.insert(colors.begin(), colors.end());
+    colorSet.Clear();
+    for (const auto& color : colors)
+        colorSet.Insert(color);
+    labColors.clear();
     labColors.reserve(colors.size());
     for (const auto& color : colors)
         labColors.push_back(ColorLAB(color));
+    InvalidateColormap();
 }
 
 bool ColorArray::Set(unsigned int index, const Color16& color)
@@ -42,7 +49,8 @@ bool ColorArray::Set(unsigned int index, const Color16& color)
     {
         colors.resize(index + 1);
         labColors.resize(index + 1);
-        colorSet.insert(colors.begin(), colors.end());
+        for (const auto& c : colors)
+            colorSet.Insert(c);
     }
 
     Color16 old = colors[index];
@@ -50,85 +58,107 @@ bool ColorArray::Set(unsigned int index, const Color16& color)
     if (old == color)
         return true;
 
-    if (colorSet.find(color) != colorSet.end())
+    if (colorSet.Contains(color))
         return false;
 
     colors[index] = color;
-    colorSet.erase(old);
-    colorSet.insert(color);
+    colorSet.Erase(old);
+    colorSet.Insert(color);
     labColors[index] = ColorLAB(color);
+    InvalidateColormap();
 
     return true;
 }
 
 int ColorArray::Search(const Color16& color) const
 {
-    unsigned long bestd = 0x7FFFFFFF;
-    int index = -1;
+    unsigned int key = color.ToIndex();
+    if (inverseColormap.empty())
+        inverseColormap.resize(COLORMAP_PAGES);
+    std::vector<unsigned short>& page = inverseColormap[key / COLORMAP_PAGE_SIZE];
+    if (page.empty())
+        page.resize(COLORMAP_PAGE_SIZE);
+    unsigned short& entry = page[key % COLORMAP_PAGE_SIZE];
+    if (entry)
+        return entry - 1;
+
+    unsigned long bestd;
+    ColorLAB a(color);
+    int index = FindNearest(a, bestd);
 
-    if (colorEntryStats.find(color) != colorEntryStats.end())
+    entry = index + 1;
+
+    if (bestd != 0)
     {
-        int index = colorEntryStats[color].index;
-        colorEntryStats[color].count += 1;
-        paletteEntryStats[index].used_count += 1;
-        paletteEntryStats[index].error += colorEntryStats[color].error;
-        if (colorEntryStats[color].error == 0)
-            paletteEntryStats[index].perfect_count += 1;
-        return index;
+        VerboseLog("Color remap: Color (%d %d %d) (%d %d %d) given to palette not an exact match. palette entry: %d - (%d %d %d) (%d %d %d).  dist: %ld.",
+                   color.r, color.g, color.b, a.l, a.a, a.b, index, colors[index].r, colors[index].g, colors[index].b,
+                   labColors[index].l, labColors[index].a, labColors[index].b, bestd);
     }
 
-    ColorLAB a(color);
-    for (unsigned int i = 0; i < labColors.size(); i++)
+    return index;
+}
+
+void ColorArray::FillColormap() const
+{
+    if (inverseColormap.empty())
+        inverseColormap.resize(COLORMAP_PAGES);
+
+    for (unsigned int i = 0; i < COLORMAP_PAGES; i++)
+    {
+        std::vector<unsigned short>& page = inverseColormap[i];
+        if (page.empty())
+            page.resize(COLORMAP_PAGE_SIZE);
+
+        for (unsigned int j = 0; j < COLORMAP_PAGE_SIZE; j++)
+        {
+            if (page[j])
+                continue;
+            unsigned int key = i * COLORMAP_PAGE_SIZE + j;
+            unsigned long bestd;
+            page[j] = FindNearest(ColorLAB(Color16(key & 0x1F, key >> 5 & 0x1F, key >> 10 & 0x1F)), bestd) + 1;
+        }
+    }
+}
+
+int FindNearestColor(const ColorLAB* labColors, unsigned int count, const ColorLAB& color, unsigned long& bestd)
+{
+    bestd = 0x7FFFFFFF;
+    int index = -1;
+
+    for (unsigned int i = 0; i < count; i++)
     {
         const ColorLAB& b = labColors[i];
-        unsigned long dist = a.Distance(b);
+        unsigned long dist = color.Distance(b);
         if (dist <= bestd)
         {
             index = i;
             bestd = dist;
 
             if (bestd == 0)
-            {
-                paletteEntryStats[index].perfect_count += 1;
                 break;
-            }
         }
     }
 
-    colorEntryStats[color].index = index;
-    colorEntryStats[color].count += 1;
-    colorEntryStats[color].error = bestd;
-
-    paletteEntryStats[index].used_count += 1;
-    paletteEntryStats[index].error += bestd;
-
-    if (bestd != 0)
-    {
-        VerboseLog("Color remap: Color (%d %d %d) (%d %d %d) given to palette not an exact match. palette entry: %d - (%d %d %d) (%d %d %d).  dist: %ld.",
-                   color.r, color.g, color.b, a.l, a.a, a.b, index, colors[index].r, colors[index].g, colors[index].b,
-                   labColors[index].l, labColors[index].a, labColors[index].b, bestd);
-    }
-
     return index;
 }
 
+int ColorArray::FindNearest(const ColorLAB& color, unsigned long& bestd) const
+{
+    return FindNearestColor(labColors.data(), labColors.size(), color, bestd);
+}
+
 bool ColorArray::Contains(const ColorArray& palette) const
 {
-    for (const auto& color : palette.colors)
-    {
-        if (colorSet.find(color) == colorSet.end())
-            return false;
-    }
-    return true;
+    return colorSet.CountMissing(palette.colorSet) == 0;
 }
 
 void ColorArray::Add(const Color16& c)
 {
-    if (colorSet.find(c) == colorSet.end())
+    if (colorSet.Insert(c))
     {
-        colorSet.insert(c);
         colors.push_back(c);
         labColors.push_back(ColorLAB(c));
+        InvalidateColormap();
     }
 }
 
@@ -164,14 +194,15 @@ struct ColorError
 
 void PaletteBank::CanMerge(const ColorArray& palette, int& colors_left, int& delta) const
 {
-    int size = colorSet.size();
+    // Every entry of palette is counted, padding duplicates included.
+    int size = colorSet.Size();
 
     for (const auto& color : palette.GetColors())
-        if (colorSet.find(color) == colorSet.end())
+        if (!colorSet.Contains(color))
             size++;
 
     colors_left = 16 - size;
-    delta = size - colorSet.size();
+    delta = size - colorSet.Size();
 }
 
 void PaletteBank::Merge(const ColorArray& palette)
@@ -184,7 +215,7 @@ void PaletteBank::BestMerge(const ColorArray& palette)
 {
     // Add the colors that will reduce error the most
     // The rest will be matched.
-    int dropX = 16 - colorSet.size();
+    int dropX = 16 - colorSet.Size();
 
     std::vector<ColorError> colors;
     for (const auto& color : palette.GetColors())
@@ -210,7 +241,7 @@ unsigned long PaletteBank::CalculateError(const Color16& color) const
 
 unsigned long PaletteBank::CalculateError(const ColorArray& palette) const
 {
-    int dropX = 16 - colorSet.size();
+    int dropX = 16 - colorSet.Size();
     std::vector<unsigned long> errors;
     errors.reserve(palette.Size());
 
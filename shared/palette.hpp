@@ -9,21 +9,8 @@
 #include "color.hpp"
 #include "exportable.hpp"
 
-struct PaletteEntryStats
-{
-    PaletteEntryStats() : used_count(0), perfect_count(0), error(0) {}
-    int used_count;
-    int perfect_count;
-    unsigned long error;
-};
-
-struct ColorEntryStats
-{
-    ColorEntryStats() : index(0), count(0), error(0) {}
-    int index;
-    int count;
-    unsigned long error;
-};
+/** Index of the closest of count labColors to color, -1 if count is 0. Ties go to the last closest color unless it is an exact match. */
+int FindNearestColor(const ColorLAB* labColors, unsigned int count, const ColorLAB& color, unsigned long& bestd);
 
 /** Base class for palettes/palette banks.  Represents a set of colors. */
 class ColorArray
@@ -40,6 +27,8 @@ class ColorArray
         const Color16& At(int index) const {return colors[index];}
         /** Search palette for color passed in returns the closest palette index that matches the color */
         int Search(const Color16& color) const;
+        /** Fills the Search cache for every Color16, afterwards Search is safe to call from several threads */
+        void FillColormap() const;
         /** Are all colors contained in the palette? */
         bool Contains(const ColorArray& palette) const;
         /** Adds a color to the palette */
@@ -47,15 +36,19 @@ class ColorArray
         /** Gets size of this palette */
         unsigned int Size() const {return colors.size();}
         /** Gets colors in palette */
-        const std::vector<Color16> GetColors() const {return colors;}
-        mutable std::map<int, PaletteEntryStats> paletteEntryStats;
-        /** Cache to speed up repeatedly hit colors */
-        mutable std::map<Color16, ColorEntryStats> colorEntryStats;
+        const std::vector<Color16>& GetColors() const {return colors;}
     protected:
+        /** Forgets all cached Search results, must be called when colors change */
+        void InvalidateColormap() {inverseColormap.clear();}
+        /** Index of the color in labColors closest to color, -1 if empty */
+        int FindNearest(const ColorLAB& color, unsigned long& bestd) const;
         /** Colors contained in palette with set to prevent duplicates */
         std::vector<Color16> colors;
         std::vector<ColorLAB> labColors;
-        std::set<Color16> colorSet;
+        ColorSet colorSet;
+        /** Inverse colormap caching Search, palette index + 1 for each Color16::ToIndex (0 = not searched yet).
+          * Split into pages by blue component that are only allocated once a color in them is searched. */
+        mutable std::vector<std::vector<unsigned short>> inverseColormap;
 };
 
 /** Palette class, just an exportable color array */
@@ -106,4 +99,10 @@ class PaletteBankManager : public Exportable
         std::vector<PaletteBank> banks;
 };
 
+/** Picks a bank for each palette, merged in the order given. Palettes go to the last bank containing them or else the bank
+  * they add the fewest colors to. If that leaves some palette without a bank, seeded local searches move palettes between banks
+  * for a fixed number of iterations, time_ms only bounds how long they may take. bank[i] is the bank for palettes[i], all -1
+  * if no packing was found. Implemented in bank-packer.cpp */
+bool PackPaletteBanks(const std::vector<std::vector<Color16>>& palettes, const PaletteBankManager& banks, unsigned int time_ms, std::vector<int>& bank);
+
 #endif
@@ -0,0 +1,59 @@
+#include "quantizer.hpp"
+
+#include <algorithm>
+
+#include "logger.hpp"
+
+void CountColors(const std::vector<Color16>& pixels, std::vector<ColorCount>& counts)
+{
+    if (pixels.empty())
+        return;
+
+    std::vector<unsigned short> keys;
+    keys.reserve(pixels.size());
+    for (const auto& color : pixels)
+        keys.push_back(color.ToIndex());
+    std::sort(keys.begin(), keys.end());
+
+    size_t old_size = counts.size();
+    for (unsigned int i = 0; i < keys.size();)
+    {
+        unsigned int j = i;
+        while (j < keys.size() && keys[j] == keys[i])
+            j++;
+        unsigned short key = keys[i];
+        counts.emplace_back(Color16(key & 0x1F, key >> 5 & 0x1F, key >> 10 & 0x1F), j - i);
+        i = j;
+    }
+
+    if (old_size == 0)
+        return;
+
+    // Merge with the colors counted before.
+    auto by_index = [](const ColorCount& lhs, const ColorCount& rhs) {return lhs.color.ToIndex() < rhs.color.ToIndex();};
+    std::inplace_merge(counts.begin(), counts.begin() + old_size, counts.end(), by_index);
+    unsigned int last = 0;
+    for (unsigned int i = 1; i < counts.size(); i++)
+    {
+        if (counts[i].color.ToIndex() == counts[last].color.ToIndex())
+            counts[last].count += counts[i].count;
+        else
+            counts[++last] = counts[i];
+    }
+    counts.erase(counts.begin() + last + 1, counts.end());
+}
+
+std::unique_ptr<Quantizer> CreateQuantizer(const std::string& name)
+{
+    if (name.empty() || name == "mediancut")
+        return std::make_unique<MedianCutQuantizer>();
+    else if (name == "wu")
+        return std::make_unique<WuQuantizer>();
+    else if (name == "octree")
+        return std::make_unique<OctreeQuantizer>();
+    else if (name == "kmeans")
+        return std::make_unique<KMeansQuantizer>();
+
+    FatalLog("Unknown quantizer %s. Valid quantizers are [mediancut, wu, octree, kmeans].", name.c_str());
+    return nullptr;
+}
@@ -0,0 +1,63 @@
+#ifndef QUANTIZER_HPP
+#define QUANTIZER_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "color.hpp"
+
+/** A distinct color and the number of pixels with that color */
+struct ColorCount
+{
+    ColorCount(const Color16& _color, unsigned long _count) : color(_color), count(_count) {}
+    Color16 color;
+    unsigned long count;
+};
+
+/** Counts the distinct colors in pixels merging them into counts, which is kept sorted by Color16::ToIndex */
+void CountColors(const std::vector<Color16>& pixels, std::vector<ColorCount>& counts);
+
+/** Base class for algorithms reducing a set of colors to a palette of at most num_colors colors. */
+class Quantizer
+{
+    public:
+        virtual ~Quantizer() {}
+        virtual void Quantize(const std::vector<ColorCount>& colors, unsigned int num_colors, std::vector<Color16>& palette) const = 0;
+};
+
+/** Median cut in LAB space, the default. Implemented in mediancut.cpp */
+class MedianCutQuantizer : public Quantizer
+{
+    public:
+        void Quantize(const std::vector<ColorCount>& colors, unsigned int num_colors, std::vector<Color16>& palette) const;
+};
+
+/** Xiaolin Wu's variance minimizing quantizer over the 32x32x32 Color16 cube. Implemented in wu.cpp */
+class WuQuantizer : public Quantizer
+{
+    public:
+        void Quantize(const std::vector<ColorCount>& colors, unsigned int num_colors, std::vector<Color16>& palette) const;
+};
+
+/** Octree quantizer, never holds more than num_colors leaves while colors are inserted. Implemented in octree.cpp */
+class OctreeQuantizer : public Quantizer
+{
+    public:
+        void Quantize(const std::vector<ColorCount>& colors, unsigned int num_colors, std::vector<Color16>& palette) const;
+};
+
+/** K-means refinement in LAB space seeded by median cut. Implemented in kmeans.cpp */
+class KMeansQuantizer : public Quantizer
+{
+    public:
+        KMeansQuantizer(unsigned int _iterations = 16) : iterations(_iterations) {}
+        void Quantize(const std::vector<ColorCount>& colors, unsigned int num_colors, std::vector<Color16>& palette) const;
+    private:
+        unsigned int iterations;
+};
+
+/** Creates the quantizer by name (mediancut, wu, octree, kmeans), empty gives median cut. */
+std::unique_ptr<Quantizer> CreateQuantizer(const std::string& name);
+
+#endif
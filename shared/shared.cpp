@@ -1,8 +1,13 @@
 #include "shared.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <cstring>
+#include <exception>
+#include <mutex>
 #include <sstream>
+#include <thread>
 #include <wx/filename.h>
 
 std::string ToUpper(const std::string& str)
@@ -50,3 +55,145 @@ unsigned int log2(unsigned int x)
     while (x >>= 1) result++;
     return result;
 }
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t RotateLeft(uint64_t x, int bits)
+{
+    return (x << bits) | (x >> (64 - bits));
+}
+
+static inline uint64_t Read64(const unsigned char* p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t Read32(const unsigned char* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t XXH64Round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = RotateLeft(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t XXH64Merge(uint64_t acc, uint64_t value)
+{
+    acc ^= XXH64Round(0, value);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    uint64_t hash;
+
+    if (size >= 32)
+    {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = XXH64Round(v1, Read64(p));
+            v2 = XXH64Round(v2, Read64(p + 8));
+            v3 = XXH64Round(v3, Read64(p + 16));
+            v4 = XXH64Round(v4, Read64(p + 24));
+        }
+        hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+        hash = XXH64Merge(hash, v1);
+        hash = XXH64Merge(hash, v2);
+        hash = XXH64Merge(hash, v3);
+        hash = XXH64Merge(hash, v4);
+    }
+    else
+    {
+        hash = seed + XXH_PRIME64_5;
+    }
+
+    hash += size;
+    for (; p + 8 <= end; p += 8)
+    {
+        hash ^= XXH64Round(0, Read64(p));
+        hash = RotateLeft(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (p + 4 <= end)
+    {
+        hash ^= Read32(p) * XXH_PRIME64_1;
+        hash = RotateLeft(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++)
+    {
+        hash ^= *p * XXH_PRIME64_5;
+        hash = RotateLeft(hash, 11) * XXH_PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/** Set on threads running ParallelFor work, nested calls run inline instead of starting more threads */
+static thread_local bool in_parallel_for = false;
+
+void ParallelFor(unsigned int count, const std::function<void(unsigned int)>& func)
+{
+    unsigned int num_threads = std::min(count, std::max(1U, std::thread::hardware_concurrency()));
+    if (num_threads <= 1 || in_parallel_for)
+    {
+        for (unsigned int i = 0; i < count; i++)
+            func(i);
+        return;
+    }
+
+    std::atomic<unsigned int> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]()
+    {
+        in_parallel_for = true;
+        for (unsigned int i = next++; i < count; i = next++)
+        {
+            try
+            {
+                func(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+                // Stop handing out work.
+                next = count;
+            }
+        }
+        in_parallel_for = false;
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < num_threads; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
@@ -1,6 +1,9 @@
 #ifndef SHARED_HPP
 #define SHARED_HPP
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <set>
 #include <string>
 #include <vector>
@@ -10,5 +13,33 @@ std::string Chop(const std::string& filename);
 std::string Sanitize(const std::string& filename);
 std::string Format(const std::string& filename);
 unsigned int log2(unsigned int x);
+/** 64 bit xxHash (XXH64) of size bytes */
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0);
+/** Calls func(i) for each i in [0, count) using all cores, the first exception thrown is rethrown once every call is done.
+  * Indices are handed out in increasing order, calls made from inside func run serially on the calling thread. */
+void ParallelFor(unsigned int count, const std::function<void(unsigned int)>& func);
+
+/** Copy of the pixels of a width x height image laid out tile by tile, each 8x8 tile as 64 pixels in a row.
+  * Empty if width or height isn't a multiple of 8. */
+template <typename T>
+std::vector<T> BlockPixels(const std::vector<T>& pixels, unsigned int width, unsigned int height)
+{
+    std::vector<T> blocks;
+    if (width % 8 || height % 8)
+        return blocks;
+    blocks.reserve(pixels.size());
+    for (unsigned int tiley = 0; tiley < height / 8; tiley++)
+    {
+        for (unsigned int tilex = 0; tilex < width / 8; tilex++)
+        {
+            for (unsigned int i = 0; i < 8; i++)
+            {
+                auto row = pixels.begin() + (tiley * 8 + i) * width + tilex * 8;
+                blocks.insert(blocks.end(), row, row + 8);
+            }
+        }
+    }
+    return blocks;
+}
 
 #endif
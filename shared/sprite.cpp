@@ -582,27 +582,36 @@ void SpriteScene::Init4bpp(const std::vector<Image16Bpp>& images16)
 
     // Palette bank selection time
     // Ensure image contains < 256 colors
-    std::set<Color16> bigPalette;
+    ColorSet bigPalette;
     for (const auto& sprite : sprites)
     {
         const std::vector<Color16>& sprite_palette = sprite->palette->GetColors();
-        bigPalette.insert(sprite_palette.begin(), sprite_palette.end());
+        for (const auto& color : sprite_palette)
+            bigPalette.Insert(color);
     }
 
-    if (bigPalette.size() > 256 && !params.force)
-        FatalLog("Image after reducing tiles to 4 bpp still contains more than 256 distinct colors. Found %d colors. Please fix. Use --force to override.", bigPalette.size());
-    else if (bigPalette.size() > 256 && params.force)
+    if (bigPalette.Size() > 256 && !params.force)
+        FatalLog("Image after reducing tiles to 4 bpp still contains more than 256 distinct colors. Found %d colors. Please fix. Use --force to override.", bigPalette.Size());
+    else if (bigPalette.Size() > 256 && params.force)
         WarnLog("Image after reducing tiles to 4 bpp still contains more than 256 distinct colors. Found %d colors. Potential for image color quality loss.");
 
     // Greedy approach deal with tiles with largest palettes first.
     std::sort(sprites.begin(), sprites.end(), SpritePaletteSizeComp);
 
+    // Plan the banks up front, only differs from the greedy choices below when those leave sprites without a bank.
+    std::vector<std::vector<Color16>> sprite_palettes;
+    for (const auto& sprite : sprites)
+        sprite_palettes.push_back(sprite->palette->GetColors());
+    std::vector<int> planned;
+    PackPaletteBanks(sprite_palettes, paletteBanks, params.pack_time_ms, planned);
+
     // Construct palette banks, assign bank id to tile, remap sprite to palette bank given, assign tile ids
-    for (auto& sprite : sprites)
+    for (unsigned int k = 0; k < sprites.size(); k++)
     {
-        int pbank = -1;
+        Sprite* sprite = sprites[k];
+        int pbank = planned[k];
         // Fully contains checks
-        for (unsigned int i = 0; i < paletteBanks.Size(); i++)
+        for (unsigned int i = 0; i < paletteBanks.Size() && planned[k] == -1; i++)
         {
             PaletteBank& bank = paletteBanks[i];
             if (bank.Contains(*sprite->palette))
@@ -0,0 +1,169 @@
+#include "tile-stream.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#include "logger.hpp"
+#include "export_params.hpp"
+#include "fileutils.hpp"
+#include "shared.hpp"
+#include "tile.hpp"
+
+TileStream::TileStream(const std::string& name, const std::vector<int>& tileIds, unsigned int _width, unsigned int _height, bool _columns,
+                       unsigned int _window_width, unsigned int _window_height) : Exportable(name), slots(tileIds.size(), 0), num_slots(1),
+                       width(_width), height(_height), columns(_columns), window_width(std::min(_window_width, _width)),
+                       window_height(std::min(_window_height, _height))
+{
+    int max_tile = *std::max_element(tileIds.begin(), tileIds.end());
+    if (max_tile > 0xFFFF)
+        FatalLog("Image: %s Too many tiles to stream. Found %d tiles. Maximum is 65536.", name.c_str(), max_tile + 1);
+    tiles.assign(tileIds.begin(), tileIds.end());
+
+    // Entries of a tile in the same window sized cell form a group, as do those in neighbouring cells, so a tile repeated
+    // all over the map (like open sky) is one group. Each group keeps one slot wherever it is in view.
+    unsigned int cells_width = (width + window_width - 1) / window_width;
+    auto key_of = [&](int tile, unsigned int cx, unsigned int cy) {return (uint64_t)tile << 32 | (cy * cells_width + cx);};
+    std::vector<uint64_t> keys;
+    std::vector<int> parent;
+    TileIndex index;
+    auto find = [&](uint64_t key) {return index.Find(HashBytes(&key, sizeof(key)), [&](int id) {return keys[id] == key;});};
+    auto root = [&](int id)
+    {
+        while (parent[id] != id)
+            id = parent[id] = parent[parent[id]];
+        return id;
+    };
+
+    std::vector<int> group(tileIds.size(), -1);
+    for (unsigned int i = 0; i < tileIds.size(); i++)
+    {
+        if (!tileIds[i])
+            continue;
+        uint64_t key = key_of(tileIds[i], i % width / window_width, i / width / window_height);
+        int id = find(key);
+        if (id == -1)
+        {
+            id = keys.size();
+            index.Insert(HashBytes(&key, sizeof(key)), id);
+            keys.push_back(key);
+            parent.push_back(id);
+        }
+        group[i] = id;
+    }
+
+    // Right, below left, below and below right, the other neighbours join from their side.
+    const int dx[] = {1, -1, 0, 1};
+    const int dy[] = {0, 1, 1, 1};
+    for (unsigned int id = 0; id < keys.size(); id++)
+    {
+        int tile = keys[id] >> 32;
+        int cx = (keys[id] & 0xFFFFFFFF) % cells_width;
+        int cy = (keys[id] & 0xFFFFFFFF) / cells_width;
+        for (int k = 0; k < 4; k++)
+        {
+            if (cx + dx[k] < 0 || cx + dx[k] >= (int)cells_width)
+                continue;
+            int other = find(key_of(tile, cx + dx[k], cy + dy[k]));
+            if (other != -1)
+                parent[root(other)] = root(id);
+        }
+    }
+
+    // Groups in the order they first come into view going column by column (row by row), with their entries.
+    unsigned int num_lines = columns ? width : height;
+    unsigned int line_length = columns ? height : width;
+    std::vector<int> order;
+    std::vector<std::vector<unsigned int>> members(keys.size());
+    for (unsigned int line = 0; line < num_lines; line++)
+    {
+        for (unsigned int i = 0; i < line_length; i++)
+        {
+            unsigned int entry = Entry(line, i);
+            if (group[entry] == -1)
+                continue;
+            int id = root(group[entry]);
+            group[entry] = id;
+            if (members[id].empty())
+                order.push_back(id);
+            members[id].push_back(entry);
+        }
+    }
+
+    // Two entries are in some window together when they are less than a window apart across and down. Each group takes the
+    // lowest slot that no group already given one uses that close to any of its entries, later groups keep clear of it in turn.
+    std::vector<int> group_slot(keys.size(), -1);
+    std::vector<unsigned int> used(order.size() + 2, 0);
+    for (unsigned int n = 0; n < order.size(); n++)
+    {
+        int id = order[n];
+        for (unsigned int entry : members[id])
+        {
+            unsigned int x = entry % width;
+            unsigned int y = entry / width;
+            unsigned int x0 = x + 1 >= window_width ? x + 1 - window_width : 0;
+            unsigned int y0 = y + 1 >= window_height ? y + 1 - window_height : 0;
+            unsigned int x1 = std::min(x + window_width - 1, width - 1);
+            unsigned int y1 = std::min(y + window_height - 1, height - 1);
+            for (unsigned int ny = y0; ny <= y1; ny++)
+            {
+                for (unsigned int nx = x0; nx <= x1; nx++)
+                {
+                    int other = group[ny * width + nx];
+                    if (other != -1 && group_slot[other] != -1)
+                        used[group_slot[other]] = n + 1;
+                }
+            }
+        }
+        unsigned int slot = 1;
+        while (used[slot] == n + 1)
+            slot++;
+        group_slot[id] = slot;
+        num_slots = std::max(num_slots, slot + 1);
+    }
+
+    for (unsigned int i = 0; i < tileIds.size(); i++)
+        if (group[i] != -1)
+            slots[i] = group_slot[group[i]];
+
+    if (num_slots > 1024 && !params.force)
+        FatalLog("Image: %s Too many tiles in view at once to stream. Found %d tiles. Maximum is 1024. Please make the map simpler. Use --force to override.",
+                 name.c_str(), num_slots);
+    else if (num_slots > 1024 && params.force)
+        WarnLog("Image: %s Too many tiles in view at once to stream. Found %d tiles. Maximum is 1024. The map exported will be incorrect.",
+                name.c_str(), num_slots);
+
+    InfoLog("Image: %s Streams %d tiles through %d slots for a %dx%d window.", name.c_str(), max_tile + 1, num_slots, window_width, window_height);
+}
+
+void TileStream::WriteData(std::ostream& file) const
+{
+    unsigned int num_lines = columns ? width : height;
+    unsigned int line_length = columns ? height : width;
+    std::vector<unsigned short> pairs;
+    pairs.reserve(tiles.size() * 2);
+    for (unsigned int line = 0; line < num_lines; line++)
+    {
+        for (unsigned int i = 0; i < line_length; i++)
+        {
+            unsigned int entry = Entry(line, i);
+            pairs.push_back(slots[entry]);
+            pairs.push_back(tiles[entry]);
+        }
+    }
+    WriteShortArray(file, name, "_stream", pairs, 16);
+    WriteNewLine(file);
+}
+
+void TileStream::WriteExport(std::ostream& file) const
+{
+    // The (slot, tile) pair of entry (x, y) is at 2 * (x * height + y) if column major, else 2 * (y * width + x).
+    // Moving the window at (x, y) one column right loads the pairs of column x + WINDOW_WIDTH, rows y to y + WINDOW_HEIGHT - 1,
+    // moving it left loads those of column x - 1, rows likewise. Tiles leaving need nothing done, their slots are just reused.
+    WriteExtern(file, "const unsigned short", name, "_stream", tiles.size() * 2);
+    WriteDefine(file, name, "_STREAM_SLOTS", num_slots);
+    WriteDefine(file, name, "_STREAM_WINDOW_WIDTH", window_width);
+    WriteDefine(file, name, "_STREAM_WINDOW_HEIGHT", window_height);
+    WriteDefine(file, name, "_STREAM_COLUMN_MAJOR", columns);
+    WriteNewLine(file);
+}
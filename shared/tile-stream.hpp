@@ -0,0 +1,37 @@
+#ifndef TILE_STREAM_HPP
+#define TILE_STREAM_HPP
+
+#include <vector>
+
+#include "exportable.hpp"
+
+/** Tiles each screen sized camera window over a map needs, for maps with more tiles than fit in VRAM at once.
+  * The window can be at any position on the map and steps a column or a row at a time. Tiles get VRAM slots such that
+  * the tiles in any one window never share a slot, so map entries refer to slots instead of tiles and only the entries
+  * of the column or row entering the window are loaded each step. Slot 0 always holds the null tile. */
+class TileStream : public Exportable
+{
+    public:
+        /** tileIds is the tile of each entry of a width x height map, the window is window_width x window_height entries.
+          * Slots are given and the export is ordered column by column if columns, else row by row. */
+        TileStream(const std::string& name, const std::vector<int>& tileIds, unsigned int width, unsigned int height, bool columns,
+                   unsigned int window_width, unsigned int window_height);
+        void WriteData(std::ostream& file) const;
+        void WriteExport(std::ostream& file) const;
+        /** VRAM slot of the tile of each entry */
+        std::vector<unsigned short> slots;
+        /** Slots needed, at least the most tiles any window needs at once */
+        unsigned int num_slots;
+    private:
+        /** Index of the entry at position i of line, lines being columns or rows */
+        unsigned int Entry(unsigned int line, unsigned int i) const {return columns ? i * width + line : line * width + i;}
+        /** Tile of each entry */
+        std::vector<unsigned short> tiles;
+        unsigned int width;
+        unsigned int height;
+        bool columns;
+        unsigned int window_width;
+        unsigned int window_height;
+};
+
+#endif
@@ -1,5 +1,10 @@
 #include "tile.hpp"
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <type_traits>
+
 #include "logger.hpp"
 #include "export_params.hpp"
 #include "fileutils.hpp"
@@ -14,8 +19,25 @@ const ImageTile& ImageTile::GetNullTile()
     return nullTile;
 }
 
-ImageTile::ImageTile(const Image16Bpp& image, int tilex, int tiley, int border) : id(0), pixels(TILE_SIZE)
+static_assert(std::is_trivially_copyable<ImageTile>::value, "ImageTile must be a plain value");
+static_assert(std::is_trivially_copyable<Tile>::value, "Tile must be a plain value");
+
+void TilePalette::Set(const std::vector<Color16>& _colors)
+{
+    if (_colors.size() > PALETTE_SIZE)
+        FatalLog("Internal Error tile palette given %d colors. This shouldn't happen", _colors.size());
+    std::copy(_colors.begin(), _colors.end(), colors.begin());
+    size = _colors.size();
+}
+
+ImageTile::ImageTile(const Image16Bpp& image, int tilex, int tiley, int border) : id(0)
 {
+    if (!border && !image.blocks.empty())
+    {
+        const Color16* block = image.BlockAt(tilex, tiley);
+        std::copy(block, block + TILE_SIZE, pixels.begin());
+        return;
+    }
     for (int i = 0; i < 8; i++)
     {
         for (int j = 0; j < 8; j++)
@@ -38,6 +60,15 @@ bool ImageTile::IsEqual(const ImageTile& other) const
     return pixels == other.pixels;
 }
 
+uint64_t ImageTile::Fingerprint() const
+{
+    // Hash what operator== compares, Color16 equality ignores alpha.
+    unsigned short keys[TILE_SIZE];
+    for (int i = 0; i < TILE_SIZE; i++)
+        keys[i] = pixels[i].ToIndex();
+    return HashBytes(keys, sizeof(keys));
+}
+
 bool ImageTile::IsSameAs(const ImageTile& other) const
 {
     bool same, sameh, samev, samevh;
@@ -66,34 +97,66 @@ const Tile& Tile::GetNullTile4()
     return nullTile;
 }
 
-Tile::Tile(const Image16Bpp& image, int tilex, int tiley, int border, int _bpp) : id(0), bpp(_bpp), palette_bank(-1),
-    sourceTile(new ImageTile(image, tilex, tiley, border))
+Tile::Tile(const Image16Bpp& image, int tilex, int tiley, int border, int _bpp) : Tile(ImageTile(image, tilex, tiley, border), _bpp)
 {
-    const std::vector<Color16>& imgdata = sourceTile->pixels;
-    unsigned int num_colors = 1 << bpp;
-
-    pixels.reserve(TILE_SIZE);
-    GetPalette(imgdata, num_colors, params.transparent_color, 0, palette);
-    ReduceImage(imgdata, palette, params.transparent_color, 0, pixels);
 }
 
-Tile::Tile(const ImageTile& imageTile, int _bpp) : id(0), bpp(_bpp), palette_bank(-1), sourceTile(new ImageTile(imageTile))
+Tile::Tile(const ImageTile& imageTile, int _bpp) : id(0), bpp(_bpp), palette_bank(-1), sourceTile(imageTile.id)
 {
-    const std::vector<Color16>& imgdata = sourceTile->pixels;
+    if (bpp != 4)
+        FatalLog("Internal Error reducing a 16bpp tile to %d bpp. 8bpp tiles are built from an Image8Bpp. This shouldn't happen", bpp);
+
+    std::vector<Color16> imgdata(imageTile.pixels.begin(), imageTile.pixels.end());
     unsigned int num_colors = 1 << bpp;
 
-    pixels.reserve(TILE_SIZE);
-    GetPalette(imgdata, num_colors, params.transparent_color, 0, palette);
-    ReduceImage(imgdata, palette, params.transparent_color, 0, pixels);
+    Palette tile_palette;
+    GetPalette(imgdata, num_colors, params.transparent_color, 0, tile_palette);
+    palette.Set(tile_palette.GetColors());
+
+    // Same as ReduceImage, but a Palette's Search would build a colormap for these 64 pixels.
+    Color16 transparent(params.transparent_color);
+    ColorLAB labColors[PALETTE_SIZE];
+    for (unsigned int i = 0; i < palette.Size(); i++)
+        labColors[i] = ColorLAB(palette.At(i));
+    // Tiles repeat few colors so remember the index found for each.
+    unsigned short seen[TILE_SIZE];
+    unsigned char seen_index[TILE_SIZE];
+    unsigned int num_seen = 0;
+    for (int i = 0; i < TILE_SIZE; i++)
+    {
+        const Color16& color = imageTile.pixels[i];
+        unsigned short key = color.ToIndex();
+        unsigned int j = 0;
+        while (j < num_seen && seen[j] != key)
+            j++;
+        if (j == num_seen)
+        {
+            unsigned long bestd;
+            seen[j] = key;
+            seen_index[j] = (color == transparent) ? 0 : FindNearestColor(labColors, palette.Size(), ColorLAB(color), bestd);
+            num_seen++;
+        }
+        pixels[i] = seen_index[j];
+    }
 }
 
-Tile::Tile(const Image8Bpp& image, int tilex, int tiley, int border, int _bpp) : id(0), pixels(TILE_SIZE), bpp(_bpp), palette_bank(-1), palette(*image.palette)
+Tile::Tile(const Image8Bpp& image, int tilex, int tiley, int border, int _bpp) : id(0), bpp(_bpp), palette_bank(-1), sourceTile(-1)
 {
-    for (int i = 0; i < 8; i++)
+    if (!border && !image.blocks.empty())
     {
-        for (int j = 0; j < 8; j++)
-            pixels[i * 8 + j] = image.pixels[(tiley * (8+border) + i) * image.width + tilex * (8+border) + j];
+        const unsigned char* block = image.BlockAt(tilex, tiley);
+        std::copy(block, block + TILE_SIZE, pixels.begin());
+    }
+    else
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            for (int j = 0; j < 8; j++)
+                pixels[i * 8 + j] = image.pixels[(tiley * (8+border) + i) * image.width + tilex * (8+border) + j];
+        }
     }
+    if (bpp == 4)
+        palette.Set(image.palette->GetColors());
 }
 
 bool Tile::operator<(const Tile& other) const
@@ -111,6 +174,19 @@ bool Tile::IsEqual(const Tile& other) const
     return pixels == other.pixels;
 }
 
+uint64_t Tile::Fingerprint() const
+{
+    return HashBytes(pixels.data(), pixels.size());
+}
+
+Tile Tile::Flip(int flip) const
+{
+    Tile flipped(*this);
+    for (int i = 0; i < TILE_SIZE; i++)
+        flipped.pixels[i] = pixels[FlippedIndex(i, flip)];
+    return flipped;
+}
+
 bool Tile::IsSameAs(const Tile& other) const
 {
     bool same, sameh, samev, samevh;
@@ -135,7 +211,7 @@ void Tile::UsePalette(const PaletteBank& bank)
         return;
     }
 
-    std::map<int, int> remapping;
+    unsigned char remapping[PALETTE_SIZE];
     for (unsigned int i = 0; i < palette.Size(); i++)
     {
         const Color16& old = palette.At(i);
@@ -144,7 +220,7 @@ void Tile::UsePalette(const PaletteBank& bank)
 
     for (unsigned int i = 0; i < TILE_SIZE; i++)
     {
-        if (remapping.find(pixels[i]) == remapping.end())
+        if (pixels[i] >= palette.Size())
             FatalLog("Internal Error somehow tile contains invalid indicies. This shouldn't happen");
 
         pixels[i] = remapping[pixels[i]];
@@ -157,7 +233,7 @@ void Tile::UsePalette(const PaletteBank& bank)
 std::ostream& operator<<(std::ostream& file, const Tile& tile)
 {
     char buffer[7];
-    const std::vector<unsigned char>& pixels = tile.pixels;
+    const auto& pixels = tile.pixels;
     if (tile.bpp == 8)
     {
         for (unsigned int i = 0; i < TILE_SIZE_SHORTS_8BPP; i++)
@@ -177,6 +253,226 @@ std::ostream& operator<<(std::ostream& file, const Tile& tile)
     return file;
 }
 
+#define TILE_INDEX_MIN_SLOTS 64
+
+void TileIndex::Insert(uint64_t fingerprint, int id)
+{
+    // Keep the load factor under a half so probe runs stay short.
+    if ((count + 1) * 2 > slots.size())
+        Grow();
+
+    size_t mask = slots.size() - 1;
+    size_t i = fingerprint & mask;
+    while (slots[i].id != -1)
+        i = (i + 1) & mask;
+    slots[i].fingerprint = fingerprint;
+    slots[i].id = id;
+    count++;
+}
+
+void TileIndex::Grow()
+{
+    std::vector<Slot> old;
+    old.swap(slots);
+    Slot empty = {0, -1};
+    slots.resize(std::max<size_t>(TILE_INDEX_MIN_SLOTS, old.size() * 2), empty);
+
+    size_t mask = slots.size() - 1;
+    for (const auto& slot : old)
+    {
+        if (slot.id == -1)
+            continue;
+        size_t i = slot.fingerprint & mask;
+        while (slots[i].id != -1)
+            i = (i + 1) & mask;
+        slots[i] = slot;
+    }
+}
+
+unsigned long TileDistance(const TileLAB& a, const TileLAB& b)
+{
+    unsigned long distance = 0;
+    for (int i = 0; i < TILE_SIZE * 3; i++)
+    {
+        int d = a[i] - b[i];
+        distance += d * d;
+    }
+    return distance;
+}
+
+TileLAB FlipTileLAB(const TileLAB& tile, int flip)
+{
+    TileLAB flipped;
+    for (int i = 0; i < TILE_SIZE; i++)
+    {
+        int j = FlippedIndex(i, flip);
+        flipped[i * 3] = tile[j * 3];
+        flipped[i * 3 + 1] = tile[j * 3 + 1];
+        flipped[i * 3 + 2] = tile[j * 3 + 2];
+    }
+    return flipped;
+}
+
+TileLAB GetTileLAB(const ImageTile& tile)
+{
+    TileLAB lab;
+    for (int i = 0; i < TILE_SIZE; i++)
+    {
+        ColorLAB color(tile.pixels[i]);
+        lab[i * 3] = color.l;
+        lab[i * 3 + 1] = color.a;
+        lab[i * 3 + 2] = color.b;
+    }
+    return lab;
+}
+
+/** TileDistance, but stops adding once past limit */
+static unsigned long TileDistance(const TileLAB& a, const TileLAB& b, unsigned long limit)
+{
+    unsigned long distance = 0;
+    for (int i = 0; i < TILE_SIZE * 3 && distance <= limit; i += 24)
+    {
+        for (int j = i; j < i + 24; j++)
+        {
+            int d = a[j] - b[j];
+            distance += d * d;
+        }
+    }
+    return distance;
+}
+
+static double FeatureDistance(const std::array<float, TILE_FEATURES>& a, const std::array<float, TILE_FEATURES>& b)
+{
+    double distance = 0;
+    for (int i = 0; i < TILE_FEATURES; i++)
+    {
+        double d = a[i] - b[i];
+        distance += d * d;
+    }
+    return sqrt(distance);
+}
+
+TileTree::TileTree(const std::vector<TileLAB>& _tiles) : tiles(_tiles), nodeOf(_tiles.size(), -1)
+{
+    features.reserve(tiles.size());
+    for (const auto& tile : tiles)
+        features.push_back(GetFeatures(tile));
+
+    std::vector<int> ids(tiles.size());
+    for (unsigned int i = 0; i < ids.size(); i++)
+        ids[i] = i;
+    nodes.reserve(tiles.size());
+    Build(ids, 0, ids.size(), -1);
+}
+
+TileTree::Features TileTree::GetFeatures(const TileLAB& tile)
+{
+    // Sum over a block of n values over sqrt(n): by Cauchy-Schwarz the square of the difference of these is at most
+    // the sum of the squared differences of the values, so feature distance never exceeds tile distance.
+    const int blocks = 8 / TILE_BLOCK;
+    const float scale = 1.0f / TILE_BLOCK;
+    Features features;
+    features.fill(0);
+    for (int i = 0; i < TILE_SIZE; i++)
+    {
+        int block = (i / 8 / TILE_BLOCK) * blocks + (i % 8 / TILE_BLOCK);
+        for (int c = 0; c < 3; c++)
+            features[block * 3 + c] += tile[i * 3 + c] * scale;
+    }
+    return features;
+}
+
+int TileTree::Build(std::vector<int>& ids, int begin, int end, int parent)
+{
+    if (begin >= end)
+        return -1;
+
+    // The tile in the middle is the vantage point, the others split at their median distance from it.
+    std::swap(ids[begin], ids[begin + (end - begin) / 2]);
+    int index = nodes.size();
+    Node node = {ids[begin], 0, -1, -1, parent, end - begin, false};
+    nodes.push_back(node);
+    nodeOf[ids[begin]] = index;
+
+    int first = begin + 1;
+    if (first < end)
+    {
+        const Features& vantage = features[ids[begin]];
+        std::vector<std::pair<double, int>> distances;
+        distances.reserve(end - first);
+        for (int i = first; i < end; i++)
+            distances.emplace_back(FeatureDistance(vantage, features[ids[i]]), ids[i]);
+        int middle = (end - first) / 2;
+        std::nth_element(distances.begin(), distances.begin() + middle, distances.end());
+        for (int i = first; i < end; i++)
+            ids[i] = distances[i - first].second;
+        nodes[index].radius = distances[middle].first;
+
+        int inside = Build(ids, first, first + middle, index);
+        int outside = Build(ids, first + middle, end, index);
+        nodes[index].inside = inside;
+        nodes[index].outside = outside;
+    }
+    return index;
+}
+
+int TileTree::Nearest(const TileLAB& query, int skip, unsigned long& distance) const
+{
+    int best = -1;
+    distance = ULONG_MAX;
+    if (!nodes.empty())
+        Search(0, query, GetFeatures(query), skip, best, distance);
+    if (best == -1)
+        distance = 0;
+    return best;
+}
+
+void TileTree::Search(int index, const TileLAB& query, const Features& query_features, int skip, int& best, unsigned long& best_distance) const
+{
+    if (index == -1 || nodes[index].alive == 0)
+        return;
+
+    const Node& node = nodes[index];
+    double d = FeatureDistance(query_features, features[node.id]);
+    double limit = best == -1 ? INFINITY : sqrt((double)best_distance);
+    if (!node.removed && node.id != skip && d < limit)
+    {
+        unsigned long distance = TileDistance(query, tiles[node.id], best_distance);
+        if (distance < best_distance)
+        {
+            best_distance = distance;
+            best = node.id;
+            limit = sqrt((double)best_distance);
+        }
+    }
+
+    // Search the side query is on first, the other only if a closer tile could be there.
+    if (d < node.radius)
+    {
+        Search(node.inside, query, query_features, skip, best, best_distance);
+        limit = best == -1 ? INFINITY : sqrt((double)best_distance);
+        if (d + limit >= node.radius)
+            Search(node.outside, query, query_features, skip, best, best_distance);
+    }
+    else
+    {
+        Search(node.outside, query, query_features, skip, best, best_distance);
+        limit = best == -1 ? INFINITY : sqrt((double)best_distance);
+        if (d - limit <= node.radius)
+            Search(node.inside, query, query_features, skip, best, best_distance);
+    }
+}
+
+void TileTree::Remove(int id)
+{
+    int index = nodeOf[id];
+    if (nodes[index].removed)
+        return;
+    nodes[index].removed = true;
+    for (; index != -1; index = nodes[index].parent)
+        nodes[index].alive--;
+}
+
 bool TilesPaletteSizeComp(const Tile& i, const Tile& j)
 {
     return i.palette.Size() > j.palette.Size();
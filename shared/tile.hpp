@@ -1,9 +1,8 @@
 #ifndef TILE_HPP
 #define TILE_HPP
 
-#include <map>
-#include <memory>
-#include <set>
+#include <array>
+#include <cstdint>
 #include <vector>
 
 #include "color.hpp"
@@ -22,6 +21,39 @@ class Image8Bpp;
 #define SIZE_CBB_BYTES (8192 * 2)
 #define SIZE_SBB_BYTES (1024 * 2)
 #define SIZE_SBB_SHORTS 1024
+/* Flip bits of a tile, shifted by 10 they are the hflip and vflip bits of a map entry */
+#define TILE_HFLIP 1
+#define TILE_VFLIP 2
+
+/** Index of the pixel drawn at index when a tile is shown with flip */
+inline int FlippedIndex(int index, int flip)
+{
+    int x = index % 8;
+    int y = index / 8;
+    if (flip & TILE_HFLIP)
+        x = 7 - x;
+    if (flip & TILE_VFLIP)
+        y = 7 - y;
+    return y * 8 + x;
+}
+
+/** Palette of a 4bpp tile stored inline so tiles stay plain values. 8bpp tiles index the palette of their image and leave it empty. */
+class TilePalette
+{
+    public:
+        TilePalette() : size(0) {}
+        /** Sets palette to contain colors passed in */
+        void Set(const std::vector<Color16>& _colors);
+        /** Gets color at palette index */
+        const Color16& At(int index) const {return colors[index];}
+        /** Gets size of this palette */
+        unsigned int Size() const {return size;}
+        /** Gets colors in palette */
+        std::vector<Color16> GetColors() const {return std::vector<Color16>(colors.begin(), colors.begin() + size);}
+    private:
+        std::array<Color16, PALETTE_SIZE> colors;
+        unsigned int size;
+};
 
 /** This class represents a one to one mapping between an Image and Tile. */
 class ImageTile
@@ -32,39 +64,131 @@ class ImageTile
         bool IsSameAs(const ImageTile& other) const;
         bool operator<(const ImageTile& other) const;
         bool operator==(const ImageTile& other) const;
+        /** Hash of the pixels, equal tiles have equal fingerprints */
+        uint64_t Fingerprint() const;
         static const ImageTile& GetNullTile();
         int id;
-        std::vector<Color16> pixels;
+        std::array<Color16, TILE_SIZE> pixels;
     private:
-        ImageTile(const Color16& color = Color16()) : id(0), pixels(TILE_SIZE, color) {}
+        ImageTile(const Color16& color = Color16()) : id(0) {pixels.fill(color);}
 };
 
 /* */
 class Tile
 {
     public:
-        Tile(const Image16Bpp& image, int tilex, int tiley, int border = 0, int bpp = 8);
+        /** 16bpp tiles reduce to 4bpp only, 8bpp tiles are built from an Image8Bpp */
+        Tile(const Image16Bpp& image, int tilex, int tiley, int border, int bpp);
         Tile(const ImageTile& imageTile, int bpp);
         Tile(const Image8Bpp& image, int tilex, int tiley, int border = 0, int bpp = 8);
         bool IsEqual(const Tile& other) const;
         bool IsSameAs(const Tile& other) const;
         bool operator<(const Tile& other) const;
         bool operator==(const Tile& other) const;
+        /** Hash of the pixels, equal tiles have equal fingerprints */
+        uint64_t Fingerprint() const;
+        /** Copy of this tile as it is shown with flip */
+        Tile Flip(int flip) const;
         /* Set to use palette bank only for 4bpp tiles */
         void UsePalette(const PaletteBank& bank);
         static const Tile& GetNullTile8();
         static const Tile& GetNullTile4();
         int id;
-        std::vector<unsigned char> pixels;
+        std::array<unsigned char, TILE_SIZE> pixels;
         int bpp;
         int palette_bank;
-        Palette palette;
-        /* Shared because copies of tiles exist */
-        std::shared_ptr<ImageTile> sourceTile;
+        TilePalette palette;
+        /* Id of the ImageTile this tile was reduced from, -1 if it came from an Image8Bpp */
+        int sourceTile;
 
     friend std::ostream& operator<<(std::ostream& file, const Tile& tile);
     private:
-        Tile(int _bpp) : id(0), pixels(TILE_SIZE), bpp(_bpp), palette_bank(0) {}
+        Tile(int _bpp) : id(0), pixels(), bpp(_bpp), palette_bank(0), sourceTile(-1) {}
+};
+
+/** Open addressing index from tile fingerprints to tile ids, the tiles themselves are kept by the caller which compares them on fingerprint matches. */
+class TileIndex
+{
+    public:
+        TileIndex() : count(0) {}
+        /** Returns the id added under fingerprint for which equals(id) is true or -1 */
+        template <typename Equals>
+        int Find(uint64_t fingerprint, Equals equals) const
+        {
+            if (slots.empty())
+                return -1;
+            size_t mask = slots.size() - 1;
+            for (size_t i = fingerprint & mask; slots[i].id != -1; i = (i + 1) & mask)
+            {
+                if (slots[i].fingerprint == fingerprint && equals(slots[i].id))
+                    return slots[i].id;
+            }
+            return -1;
+        }
+        void Insert(uint64_t fingerprint, int id);
+        /** Forgets every id added */
+        void Clear() {slots.clear(); count = 0;}
+        size_t Size() const {return count;}
+        /** Bytes held by the slots */
+        size_t MemoryUsage() const {return slots.capacity() * sizeof(Slot);}
+    private:
+        struct Slot
+        {
+            uint64_t fingerprint;
+            int id;
+        };
+        void Grow();
+        std::vector<Slot> slots;
+        size_t count;
+};
+
+/** LAB colors of the pixels of a tile as shown, l a b for each pixel */
+typedef std::array<unsigned char, TILE_SIZE * 3> TileLAB;
+
+/** Sum of ColorLAB::Distance over the pixels of two tiles */
+unsigned long TileDistance(const TileLAB& a, const TileLAB& b);
+/** Copy of tile as it is shown with flip */
+TileLAB FlipTileLAB(const TileLAB& tile, int flip);
+/** LAB colors of the pixels of an ImageTile */
+TileLAB GetTileLAB(const ImageTile& tile);
+
+/* Pixels averaged per side of a block by TileTree */
+#define TILE_BLOCK 4
+#define TILE_FEATURES ((8 / TILE_BLOCK) * (8 / TILE_BLOCK) * 3)
+
+/** Vantage point tree for finding the tile that looks closest to another. Tiles can be removed but not added.
+  * The tree is over averages of TILE_BLOCK x TILE_BLOCK pixel blocks scaled so their distance is never more than the
+  * distance of the tiles, which prunes well where 192 components wouldn't. Only tiles that could be closer are compared pixel by pixel. */
+class TileTree
+{
+    public:
+        /** Indexes tiles by position, tiles must outlive the tree */
+        TileTree(const std::vector<TileLAB>& tiles);
+        /** Closest tile to query besides skip and removed tiles, -1 if there is none. distance is its TileDistance */
+        int Nearest(const TileLAB& query, int skip, unsigned long& distance) const;
+        void Remove(int id);
+    private:
+        typedef std::array<float, TILE_FEATURES> Features;
+        struct Node
+        {
+            int id;
+            /** Tiles with features closer to this node's tile than radius are under inside, the rest under outside */
+            double radius;
+            int inside;
+            int outside;
+            int parent;
+            /** Tiles under this node, itself included, that aren't removed */
+            int alive;
+            bool removed;
+        };
+        static Features GetFeatures(const TileLAB& tile);
+        int Build(std::vector<int>& ids, int begin, int end, int parent);
+        void Search(int node, const TileLAB& query, const Features& query_features, int skip, int& best, unsigned long& best_distance) const;
+        const std::vector<TileLAB>& tiles;
+        std::vector<Features> features;
+        std::vector<Node> nodes;
+        /** Node holding each tile */
+        std::vector<int> nodeOf;
 };
 
 bool TilesPaletteSizeComp(const Tile& i, const Tile& j);
@@ -1,15 +1,24 @@
 #include "tileset.hpp"
 
+#include <algorithm>
+#include <climits>
+#include <queue>
 #include <sstream>
 #include "logger.hpp"
 #include "export_params.hpp"
 #include "fileutils.hpp"
 #include "image16.hpp"
 #include "image8.hpp"
+#include "mediancut.hpp"
 #include "shared.hpp"
 
-Tileset::Tileset(const std::vector<Image16Bpp>& images, const std::string& name, int _bpp, bool _affine, const std::shared_ptr<Palette>& global_palette) :
-    Exportable(name), bpp(_bpp), affine(_affine), palette(global_palette), paletteBanks(name), export_shared_data(global_palette == nullptr)
+Tileset::Tileset(const std::vector<Image16Bpp>& images, const std::string& name, int bpp, bool affine, const std::shared_ptr<Palette>& global_palette) :
+    Tileset(ImageBands(images), name, bpp, affine, global_palette)
+{
+}
+
+Tileset::Tileset(const ImageBands& images, const std::string& name, int _bpp, bool _affine, const std::shared_ptr<Palette>& global_palette) :
+    Exportable(name), bpp(_bpp), affine(_affine), match_flips(params.flip_tiles && !_affine && _bpp != 16), palette(global_palette), paletteBanks(name), export_shared_data(global_palette == nullptr)
 {
     switch(bpp)
     {
@@ -28,9 +37,11 @@ Tileset::Tileset(const std::vector<Image16Bpp>& images, const std::string& name,
                     paletteBanks[i].Add(Color16(params.transparent_color));
             }
             Init4bpp(images);
+            LogMemoryUsage();
             break;
         case 8:
             Init8bpp(images);
+            LogMemoryUsage();
             break;
         case 16:
             Init16bpp(images);
@@ -45,41 +56,274 @@ Tileset* Tileset::FromImage(const Image16Bpp& image, int bpp, bool affine)
     return new Tileset(images, "", bpp, affine);
 }
 
-int Tileset::Search(const Tile& tile) const
+int Tileset::Search(const Tile& tile, int& flip) const
 {
-    const std::set<Tile>::const_iterator foundTile = tiles.find(tile);
-    if (foundTile != tiles.end())
-        return foundTile->id;
+    uint64_t key;
+    return Find(tile, key, flip);
+}
+
+int Tileset::Find(const Tile& tile, uint64_t& key, int& flip) const
+{
+    flip = 0;
+    if (!match_flips)
+    {
+        key = tile.Fingerprint();
+        return tilesIndex.Find(key, [&](int id) {return tilesExport[id] == tile;});
+    }
 
-    return -1;
+    // Flips of a tile share the fingerprint of the smallest of them.
+    const Tile variants[4] = {tile, tile.Flip(TILE_HFLIP), tile.Flip(TILE_VFLIP), tile.Flip(TILE_HFLIP | TILE_VFLIP)};
+    key = std::min_element(variants, variants + 4)->Fingerprint();
+    return tilesIndex.Find(key, [&](int id)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            if (tilesExport[id] == variants[i])
+            {
+                flip = i;
+                return true;
+            }
+        }
+        return false;
+    });
 }
 
 int Tileset::Search(const ImageTile& tile) const
 {
-    const std::set<ImageTile>::const_iterator foundTile = itiles.find(tile);
-    if (foundTile != itiles.end())
-        return foundTile->id;
+    return itilesIndex.Find(tile.Fingerprint(), [&](int id) {return itiles[id] == tile;});
+}
 
-    return -1;
+bool Tileset::Match(const ImageTile& imageTile, int& tile_id, int& pal_id, int& flip) const
+{
+    int index = Search(imageTile);
+    if (index == -1 || (size_t)index >= matches.size() || matches[index].tile_id == -1)
+        return false;
+
+    tile_id = matches[index].tile_id;
+    pal_id = matches[index].palette_bank;
+    flip = matches[index].flip;
+    if (!tile_id)
+    {
+        std::stringstream oss;
+        oss << tilesExport[tile_id];
+        VerboseLog("Tileset::Match %s %d %d", oss.str().c_str(), tile_id, pal_id);
+    }
+    return true;
 }
 
-bool Tileset::Match(const ImageTile& tile, int& tile_id, int& pal_id) const
+bool Tileset::MatchNearest(const ImageTile& imageTile, int& tile_id, int& pal_id, int& flip, unsigned long& distance) const
 {
-    const std::map<ImageTile, Tile>::const_iterator foundTile = matcher.find(tile);
-    if (foundTile != matcher.end())
+    if (!itilesTree)
     {
-        const Tile& tile = foundTile->second;
-        tile_id = tile.id;
-        pal_id = tile.palette_bank;
+        itilesLAB.resize(itiles.size());
+        ParallelFor(itiles.size(), [&](unsigned int id) {itilesLAB[id] = GetTileLAB(itiles[id]);});
+        itilesTree.reset(new TileTree(itilesLAB));
+        for (unsigned int id = 0; id < itiles.size(); id++)
+            if (id >= matches.size() || matches[id].tile_id == -1)
+                itilesTree->Remove(id);
+    }
 
-        std::stringstream oss;
-        oss << tile;
-        if (!tile_id)
-            VerboseLog("Tileset::Match %s %d %d", oss.str().c_str(), tile_id, pal_id);
-        return true;
+    // tile shown with query_flip looks like the ImageTile found, which shows its tile with the flip matched.
+    TileLAB lab = GetTileLAB(imageTile);
+    int index = -1;
+    int query_flip = 0;
+    distance = ULONG_MAX;
+    for (int i = 0; i < (match_flips ? 4 : 1); i++)
+    {
+        unsigned long d;
+        int nearest = itilesTree->Nearest(i ? FlipTileLAB(lab, i) : lab, -1, d);
+        if (nearest != -1 && d < distance)
+        {
+            index = nearest;
+            query_flip = i;
+            distance = d;
+        }
+    }
+    if (index == -1)
+        return false;
+
+    tile_id = matches[index].tile_id;
+    pal_id = matches[index].palette_bank;
+    flip = matches[index].flip ^ query_flip;
+    return true;
+}
+
+size_t Tileset::MemoryUsage() const
+{
+    return tilesExport.capacity() * sizeof(Tile) + itiles.capacity() * sizeof(ImageTile) + matches.capacity() * sizeof(TileMatch) +
+           tilesIndex.MemoryUsage() + itilesIndex.MemoryUsage();
+}
+
+void Tileset::AddTile(Tile& tile, int& flip)
+{
+    uint64_t key;
+    int id = Find(tile, key, flip);
+    if (id == -1)
+    {
+        id = tilesExport.size();
+        tile.id = id;
+        tilesIndex.Insert(key, id);
+        tilesExport.push_back(tile);
+    }
+    else
+    {
+        tile.id = id;
+    }
+}
+
+void Tileset::AddImageTile(ImageTile& imageTile)
+{
+    uint64_t fingerprint = imageTile.Fingerprint();
+    int id = itilesIndex.Find(fingerprint, [&](int id) {return itiles[id] == imageTile;});
+    if (id == -1)
+    {
+        id = itiles.size();
+        imageTile.id = id;
+        itilesIndex.Insert(fingerprint, id);
+        itiles.push_back(imageTile);
+    }
+    else
+    {
+        imageTile.id = id;
+    }
+}
+
+void Tileset::MergeSimilarTiles(unsigned int max_tiles)
+{
+    unsigned int num_tiles = tilesExport.size();
+    std::vector<TileLAB> labs(num_tiles);
+    ParallelFor(num_tiles, [&](unsigned int id)
+    {
+        const Tile& tile = tilesExport[id];
+        const ColorArray& colors = (bpp == 4) ? static_cast<const ColorArray&>(paletteBanks[tile.palette_bank]) : *palette;
+        for (int i = 0; i < TILE_SIZE; i++)
+        {
+            ColorLAB color(tile.pixels[i] < colors.Size() ? colors.At(tile.pixels[i]) : Color16());
+            labs[id][i * 3] = color.l;
+            labs[id][i * 3 + 1] = color.a;
+            labs[id][i * 3 + 2] = color.b;
+        }
+    });
+
+    // Merging into the tile more ImageTiles use changes fewer of them.
+    std::vector<int> uses(num_tiles, 1);
+    for (const auto& match : matches)
+        if (match.tile_id != -1)
+            uses[match.tile_id]++;
+
+    // A tile, the tile closest to it and the flip the first is shown with to look like the second.
+    struct Candidate
+    {
+        unsigned long distance;
+        int id;
+        int nearest;
+        int flip;
+        bool operator<(const Candidate& other) const {return distance > other.distance;}
+    };
+    TileTree tree(labs);
+    auto find_nearest = [&](int id)
+    {
+        Candidate best = {ULONG_MAX, id, -1, 0};
+        for (int flip = 0; flip < (match_flips ? 4 : 1); flip++)
+        {
+            unsigned long distance;
+            int nearest = tree.Nearest(flip ? FlipTileLAB(labs[id], flip) : labs[id], id, distance);
+            if (nearest != -1 && distance < best.distance)
+                best = {distance, id, nearest, flip};
+        }
+        return best;
+    };
+    std::vector<Candidate> candidates(num_tiles);
+    ParallelFor(num_tiles, [&](unsigned int id) {candidates[id] = find_nearest(id);});
+    std::priority_queue<Candidate> queue;
+    for (const auto& candidate : candidates)
+        if (candidate.nearest != -1)
+            queue.push(candidate);
+
+    // Closest pair first. Kept tiles don't change so only candidates whose nearest tile went need another search.
+    std::vector<int> merged(num_tiles, -1);
+    std::vector<int> merged_flip(num_tiles, 0);
+    unsigned int remaining = num_tiles;
+    unsigned long worst = 0;
+    while (remaining > max_tiles && !queue.empty())
+    {
+        Candidate candidate = queue.top();
+        queue.pop();
+        if (merged[candidate.id] != -1)
+            continue;
+        if (merged[candidate.nearest] != -1)
+        {
+            candidate = find_nearest(candidate.id);
+            if (candidate.nearest != -1)
+                queue.push(candidate);
+            continue;
+        }
+
+        // The null tile always stays.
+        int keep = candidate.nearest;
+        int drop = candidate.id;
+        if (drop == 0 || (keep != 0 && uses[keep] < uses[drop]))
+            std::swap(keep, drop);
+        merged[drop] = keep;
+        merged_flip[drop] = candidate.flip;
+        uses[keep] += uses[drop];
+        tree.Remove(drop);
+        remaining--;
+        worst = candidate.distance;
+
+        if (keep == candidate.id)
+        {
+            candidate = find_nearest(keep);
+            if (candidate.nearest != -1)
+                queue.push(candidate);
+        }
+    }
+
+    // Renumber the tiles kept, ImageTiles matched to a merged tile show the tile kept flipped the same way.
+    std::vector<int> renumber(num_tiles, -1);
+    std::vector<Tile> kept;
+    kept.reserve(remaining);
+    for (unsigned int id = 0; id < num_tiles; id++)
+    {
+        if (merged[id] != -1)
+            continue;
+        renumber[id] = kept.size();
+        kept.push_back(tilesExport[id]);
+        kept.back().id = renumber[id];
+    }
+    for (auto& match : matches)
+    {
+        if (match.tile_id == -1)
+            continue;
+        int id = match.tile_id;
+        while (merged[id] != -1)
+        {
+            match.flip ^= merged_flip[id];
+            id = merged[id];
+        }
+        if (id != match.tile_id)
+            match.palette_bank = tilesExport[id].palette_bank;
+        match.tile_id = renumber[id];
     }
+    tilesExport.swap(kept);
 
-    return false;
+    tilesIndex.Clear();
+    for (const auto& tile : tilesExport)
+    {
+        uint64_t key;
+        int flip;
+        Find(tile, key, flip);
+        tilesIndex.Insert(key, tile.id);
+    }
+
+    InfoLog("Merged %u similar tiles to fit in %u tiles. Largest difference merged %.1f per pixel.", num_tiles - remaining, max_tiles, sqrt(worst / (double)TILE_SIZE));
+    if (remaining > max_tiles)
+        WarnLog("Could only merge tiles down to %u tiles, --max_tiles asked for %u.", remaining, max_tiles);
+}
+
+void Tileset::LogMemoryUsage() const
+{
+    VerboseLog("Tileset %s holds %zu tiles and %zu image tiles in %zu bytes.", name.c_str(), tilesExport.size(), itiles.size(), MemoryUsage());
 }
 
 void Tileset::WriteData(std::ostream& file) const
@@ -119,54 +363,95 @@ void Tileset::WriteExport(std::ostream& file) const
     WriteNewLine(file);
 
     WriteExtern(file, "const unsigned short", name, "_tiles", Size());
-    WriteDefine(file, name, "_TILES", tiles.size());
+    WriteDefine(file, name, "_TILES", tilesExport.size());
     WriteDefine(file, name, "_TILES_SIZE", Size() * 2);
     WriteDefine(file, name, "_TILES_LENGTH", Size());
     WriteNewLine(file);
 }
 
-void Tileset::Init4bpp(const std::vector<Image16Bpp>& images)
+void Tileset::Init4bpp(const ImageBands& images)
 {
-    // Tile image into 16 bit tiles
-    Tileset tileset16bpp(images, name, 16, affine);
-    std::set<ImageTile> imageTiles = tileset16bpp.itiles;
-
-    const Tile& nullTile = Tile::GetNullTile4();
-    const ImageTile& nullImageTile = ImageTile::GetNullTile();
-    tiles.insert(nullTile);
-    tilesExport.push_back(nullTile);
-    matcher.insert(std::pair<ImageTile, Tile>(nullImageTile, nullTile));
+    int tile_width = 8 + params.border;
 
-    // Reduce each tile to 4bpp
+    // Deduplicate the image tiles and reduce each new one to 4bpp as it is found, gathering the colors used.
     std::vector<Tile> gbaTiles;
-    for (const auto& imageTile : imageTiles)
+    ColorSet bigPalette;
+    auto reduce = [&](const ImageTile& imageTile)
+    {
         gbaTiles.emplace_back(imageTile, 4);
-
-    // Ensure image contains < 256 colors
-    std::set<Color16> bigPalette;
-    for (const auto& tile : gbaTiles)
+        const TilePalette& tile_palette = gbaTiles.back().palette;
+        for (unsigned int i = 0; i < tile_palette.Size(); i++)
+            bigPalette.Insert(tile_palette.At(i));
+    };
+
+    // The null ImageTile is always id 0.
+    ImageTile nullImageTile = ImageTile::GetNullTile();
+    AddImageTile(nullImageTile);
+    reduce(nullImageTile);
+    for (unsigned int k = 0; k < images.Size(); k++)
     {
-        const std::vector<Color16>& tile_palette = tile.palette.GetColors();
-        bigPalette.insert(tile_palette.begin(), tile_palette.end());
+        const Image16Bpp& image = images.Get(k);
+
+        unsigned int tilesX = image.width / tile_width;
+        unsigned int tilesY = image.height / tile_width;
+        unsigned int totalTiles = tilesX * tilesY;
+
+        for (unsigned int i = 0; i < totalTiles; i++)
+        {
+            ImageTile imageTile(image, i % tilesX, i / tilesX, params.border);
+            size_t num_itiles = itiles.size();
+            AddImageTile(imageTile);
+            if (itiles.size() != num_itiles)
+                reduce(imageTile);
+        }
     }
 
-    if (bigPalette.size() > 256 && !params.force)
-        FatalLog("Image after reducing tiles to 4 bpp still contains more than 256 distinct colors. Found %d colors. Please fix. Use --force to override.", bigPalette.size());
-    else if (bigPalette.size() > 256 && params.force)
+    // Ensure image contains < 256 colors
+    if (bigPalette.Size() > 256 && !params.force)
+        FatalLog("Image after reducing tiles to 4 bpp still contains more than 256 distinct colors. Found %d colors. Please fix. Use --force to override.", bigPalette.Size());
+    else if (bigPalette.Size() > 256 && params.force)
         WarnLog("Image after reducing tiles to 4 bpp still contains more than 256 distinct colors. Found %d colors. Potential for image color quality loss.");
 
-    // Greedy approach deal with tiles with largest palettes first.
+    Tile nullTile = Tile::GetNullTile4();
+    int flip;
+    AddTile(nullTile, flip);
+    TileMatch unmatched = {-1, -1, 0};
+    matches.assign(itiles.size(), unmatched);
+    matches[0].tile_id = nullTile.id;
+    matches[0].palette_bank = nullTile.palette_bank;
+
+    // Greedy approach deal with tiles with largest palettes first, palette banks depend on starting from pixel order.
+    std::vector<int> order(gbaTiles.size());
+    for (unsigned int i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](int a, int b) {return itiles[gbaTiles[a].sourceTile] < itiles[gbaTiles[b].sourceTile];});
+    std::vector<Tile> sortedTiles;
+    sortedTiles.reserve(order.size());
+    for (int i : order)
+        sortedTiles.push_back(gbaTiles[i]);
+    gbaTiles.swap(sortedTiles);
     std::sort(gbaTiles.begin(), gbaTiles.end(), TilesPaletteSizeComp);
 
+    // Plan the banks up front, only differs from the greedy choices below when those leave tiles without a bank.
+    std::vector<std::vector<Color16>> tile_palettes;
+    tile_palettes.reserve(gbaTiles.size());
+    for (const auto& tile : gbaTiles)
+        tile_palettes.push_back(tile.palette.GetColors());
+    std::vector<int> planned;
+    PackPaletteBanks(tile_palettes, paletteBanks, params.pack_time_ms, planned);
+
     // Construct palette banks, assign bank id to tile, remap tile to palette bank given, assign tile ids
-    for (auto& tile : gbaTiles)
+    int flipped = 0;
+    for (unsigned int k = 0; k < gbaTiles.size(); k++)
     {
-        int pbank = -1;
+        Tile& tile = gbaTiles[k];
+        const ColorArray tile_palette(tile_palettes[k]);
+        int pbank = planned[k];
         // Fully contains checks
-        for (unsigned int i = 0; i < paletteBanks.Size(); i++)
+        for (unsigned int i = 0; i < paletteBanks.Size() && planned[k] == -1; i++)
         {
             PaletteBank& bank = paletteBanks[i];
-            if (bank.Contains(tile.palette))
+            if (bank.Contains(tile_palette))
                 pbank = i;
         }
 
@@ -179,7 +464,7 @@ void Tileset::Init4bpp(const std::vector<Image16Bpp>& images)
                 PaletteBank& bank = paletteBanks[i];
                 int colors_left;
                 int delta;
-                bank.CanMerge(tile.palette, colors_left, delta);
+                bank.CanMerge(tile_palette, colors_left, delta);
                 if (colors_left >= 0 && delta < min_delta)
                 {
                     min_delta = delta;
@@ -197,70 +482,91 @@ void Tileset::Init4bpp(const std::vector<Image16Bpp>& images)
         // Alright...
         if (pbank == -1)
         {
-            pbank = paletteBanks.FindBestMatch(tile.palette);
-            paletteBanks[pbank].BestMerge(tile.palette);
+            pbank = paletteBanks.FindBestMatch(tile_palette);
+            paletteBanks[pbank].BestMerge(tile_palette);
         }
         else
         {
             // Merge step and assign palette bank
-            paletteBanks[pbank].Merge(tile.palette);
+            paletteBanks[pbank].Merge(tile_palette);
         }
 
         tile.palette_bank = pbank;
         tile.UsePalette(paletteBanks[pbank]);
 
         // Assign tile id
-        const auto& it = tiles.find(tile);
-        if (it == tiles.end())
-        {
-            tile.id = tiles.size();
-            tiles.insert(tile);
-            tilesExport.push_back(tile);
-        }
-        else
-        {
-            tile.id = it->id;
-        }
+        AddTile(tile, flip);
+        if (flip)
+            flipped++;
 
         // Form mapping from ImageTile to Tile
-        matcher.insert(std::pair<ImageTile, Tile>(*tile.sourceTile, tile));
+        TileMatch& match = matches[tile.sourceTile];
+        if (match.tile_id == -1)
+        {
+            match.tile_id = tile.id;
+            match.palette_bank = tile.palette_bank;
+            match.flip = flip;
+        }
     }
 
+    if (params.max_tiles && tilesExport.size() > params.max_tiles)
+        MergeSimilarTiles(params.max_tiles);
+
     int tile_size = TILE_SIZE_BYTES_4BPP;
-    int memory_b = tiles.size() * tile_size;
+    int memory_b = tilesExport.size() * tile_size;
     // 4bpp mode so !affine can be assumed here. Affine maps have a max of 256 tiles.
-    if (tiles.size() >= 1024 && !params.force)
-        FatalLog("Too many tiles. Found %d tiles. Maximum is 1024. Please make the image simpler. Use --force to override.", tiles.size());
-    else if (tiles.size() >= 1024 && params.force)
-        WarnLog("Too many tiles. Found %d tiles. Maximum is 1024. Associated maps exported against this tileset may be incorrect.", tiles.size());
+    // Streamed maps only need the tiles in view to fit, the map checks that.
+    bool streamed = params.tile_stream != "none";
+    if (tilesExport.size() >= 1024 && !streamed && !params.force)
+        FatalLog("Too many tiles. Found %d tiles. Maximum is 1024. Please make the image simpler. Use --force to override.", tilesExport.size());
+    else if (tilesExport.size() >= 1024 && !streamed && params.force)
+        WarnLog("Too many tiles. Found %d tiles. Maximum is 1024. Associated maps exported against this tileset may be incorrect.", tilesExport.size());
 
     // Delicious infos
-    int cbbs = tiles.size() * tile_size / SIZE_CBB_BYTES;
-    int sbbs = (int) ceil(tiles.size() * tile_size % SIZE_CBB_BYTES / ((double)SIZE_SBB_BYTES));
-    InfoLog("Tiles found %zu.", tiles.size());
+    int cbbs = tilesExport.size() * tile_size / SIZE_CBB_BYTES;
+    int sbbs = (int) ceil(tilesExport.size() * tile_size % SIZE_CBB_BYTES / ((double)SIZE_SBB_BYTES));
+    InfoLog("Tiles found %zu.", tilesExport.size());
+    if (match_flips)
+        InfoLog("Tiles reused flipped %d times.", flipped);
     InfoLog("Tiles uses %d charblocks and %d screenblocks.", cbbs, sbbs);
     InfoLog("Total utilization %.2f/4 charblocks or %d/32 screenblocks, %d/65536 bytes.",
            memory_b / ((double)SIZE_CBB_BYTES), (int) ceil(memory_b / ((double)SIZE_SBB_BYTES)), memory_b);
 }
 
-void Tileset::Init8bpp(const std::vector<Image16Bpp>& images16)
+void Tileset::Init8bpp(const ImageBands& images16)
 {
     int tile_width = 8 + params.border;
 
-    // Reduce all and get the global palette and reduced images.
-    Image8BppScene scene(images16, name, palette);
-    palette = scene.palette;
+    // Reduce all and get the global palette and reduced images, world maps are reduced a band at a time below.
+    std::unique_ptr<Image8BppScene> scene;
+    if (images16.Images())
+    {
+        scene.reset(new Image8BppScene(*images16.Images(), name, palette));
+        palette = scene->palette;
+    }
+    else if (!palette)
+    {
+        palette.reset(new Palette(name));
+        GetPalette(images16, params.palette_size, params.transparent_color, params.offset, *palette);
+    }
 
-    const Tile& nullTile = Tile::GetNullTile8();
-    const ImageTile& nullImageTile = ImageTile::GetNullTile();
-    tiles.insert(nullTile);
-    tilesExport.push_back(nullTile);
-    matcher.insert(std::pair<ImageTile, Tile>(nullImageTile, nullTile));
+    Tile nullTile = Tile::GetNullTile8();
+    int flip;
+    AddTile(nullTile, flip);
+    ImageTile nullImageTile = ImageTile::GetNullTile();
+    AddImageTile(nullImageTile);
+    TileMatch nullMatch = {nullTile.id, nullTile.palette_bank, 0};
+    matches.push_back(nullMatch);
 
-    for (unsigned int k = 0; k < images16.size(); k++)
+    int flipped = 0;
+
+    for (unsigned int k = 0; k < images16.Size(); k++)
     {
-        const Image8Bpp& image = scene.GetImage(k);
-        const Image16Bpp& image16 = images16[k];
+        const Image16Bpp& image16 = images16.Get(k);
+        std::unique_ptr<Image8Bpp> band;
+        if (!scene)
+            band.reset(new Image8Bpp(image16, palette));
+        const Image8Bpp& image = scene ? scene->GetImage(k) : *band;
 
         unsigned int tilesX = image.width / tile_width;
         unsigned int tilesY = image.height / tile_width;
@@ -272,55 +578,68 @@ void Tileset::Init8bpp(const std::vector<Image16Bpp>& images16)
             int tilex = i % tilesX;
             int tiley = i / tilesX;
             Tile tile(image, tilex, tiley, params.border);
-            std::set<Tile>::iterator foundTile = tiles.find(tile);
-            if (foundTile == tiles.end())
+            size_t num_tiles = tilesExport.size();
+            AddTile(tile, flip);
+            // Tiles equal to a tile already seen were matched when it was added, flips of it need their own match.
+            if (tilesExport.size() != num_tiles || flip)
             {
-                tile.id = tiles.size();
-                tiles.insert(tile);
-                tilesExport.push_back(tile);
+                if (flip)
+                    flipped++;
                 // Add matcher data
                 ImageTile imageTile(image16, tilex, tiley, params.border);
-                matcher.insert(std::pair<ImageTile, Tile>(imageTile, tile));
+                AddImageTile(imageTile);
+                if ((size_t)imageTile.id == matches.size())
+                {
+                    TileMatch match = {tile.id, tile.palette_bank, flip};
+                    matches.push_back(match);
+                }
             }
         }
     }
 
+    if (params.max_tiles && tilesExport.size() > params.max_tiles)
+        MergeSimilarTiles(params.max_tiles);
+
     // Checks
     int tile_size = TILE_SIZE_BYTES_8BPP;
-    int memory_b = tiles.size() * tile_size;
+    int memory_b = tilesExport.size() * tile_size;
+    // Streamed maps only need the tiles in view to fit, the map checks that.
+    bool streamed = params.tile_stream != "none";
     if (params.force)
     {
-        if (!affine && tiles.size() >= 1024)
-            WarnLog("Too many tiles. Found %d tiles. Maximum is 1024. Associated maps exported against this tileset may be incorrect.", tiles.size());
-        else if (affine && tiles.size() >= 256)
-            WarnLog("Too many tiles found for affine. Found %d tiles. Maximum is 256. Associated maps exported against this tileset may be incorrect.", tiles.size());
+        if (!affine && !streamed && tilesExport.size() >= 1024)
+            WarnLog("Too many tiles. Found %d tiles. Maximum is 1024. Associated maps exported against this tileset may be incorrect.", tilesExport.size());
+        else if (affine && tilesExport.size() >= 256)
+            WarnLog("Too many tiles found for affine. Found %d tiles. Maximum is 256. Associated maps exported against this tileset may be incorrect.", tilesExport.size());
     }
     else
     {
-        if (!affine && tiles.size() >= 1024)
-            FatalLog("Too many tiles. Found %d tiles. Maximum is 1024. Please make the map/tileset simpler. Use --force to override this.", tiles.size());
-        else if (affine && tiles.size() >= 256)
-            FatalLog("Too many tiles found for affine. Found %d tiles. Maximum is 256. Please make the map/tileset simpler. Use --force to override this.", tiles.size());
+        if (!affine && !streamed && tilesExport.size() >= 1024)
+            FatalLog("Too many tiles. Found %d tiles. Maximum is 1024. Please make the map/tileset simpler. Use --force to override this.", tilesExport.size());
+        else if (affine && tilesExport.size() >= 256)
+            FatalLog("Too many tiles found for affine. Found %d tiles. Maximum is 256. Please make the map/tileset simpler. Use --force to override this.", tilesExport.size());
     }
 
     // Delicious infos
-    int cbbs = tiles.size() * tile_size / SIZE_CBB_BYTES;
-    int sbbs = (int) ceil(tiles.size() * tile_size % SIZE_CBB_BYTES / ((double)SIZE_SBB_BYTES));
-    InfoLog("Tiles found %zu.", tiles.size());
+    int cbbs = tilesExport.size() * tile_size / SIZE_CBB_BYTES;
+    int sbbs = (int) ceil(tilesExport.size() * tile_size % SIZE_CBB_BYTES / ((double)SIZE_SBB_BYTES));
+    InfoLog("Tiles found %zu.", tilesExport.size());
+    if (match_flips)
+        InfoLog("Tiles reused flipped %d times.", flipped);
     InfoLog("Tiles uses %d charblocks and %d screenblocks.", cbbs, sbbs);
     InfoLog("Total utilization %.2f/4 charblocks or %d/32 screenblocks, %d/65536 bytes.",
         memory_b / ((double)SIZE_CBB_BYTES), (int) ceil(memory_b / ((double)SIZE_SBB_BYTES)), memory_b);
 }
 
-void Tileset::Init16bpp(const std::vector<Image16Bpp>& images)
+void Tileset::Init16bpp(const ImageBands& images)
 {
     int tile_width = 8 + params.border;
-    const ImageTile& nullTile = ImageTile::GetNullTile();
-    itiles.insert(nullTile);
+    ImageTile nullTile = ImageTile::GetNullTile();
+    AddImageTile(nullTile);
 
-    for (unsigned int k = 0; k < images.size(); k++)
+    for (unsigned int k = 0; k < images.Size(); k++)
     {
-        const Image16Bpp& image = images[k];
+        const Image16Bpp& image = images.Get(k);
 
         unsigned int tilesX = image.width / tile_width;
         unsigned int tilesY = image.height / tile_width;
@@ -332,12 +651,7 @@ void Tileset::Init16bpp(const std::vector<Image16Bpp>& images)
             int tilex = i % tilesX;
             int tiley = i / tilesX;
             ImageTile tile(image, tilex, tiley, params.border);
-            std::set<ImageTile>::iterator foundTile = itiles.find(tile);
-            if (foundTile == itiles.end())
-            {
-                tile.id = itiles.size();
-                itiles.insert(tile);
-            }
+            AddImageTile(tile);
         }
     }
 }
@@ -8,36 +8,65 @@
 #include "tile.hpp"
 
 class Image16Bpp;
+class ImageBands;
 
 /** Class represents a set of 8x8 pixel tiles */
 class Tileset : public Exportable
 {
     public:
         Tileset(const std::vector<Image16Bpp>& images, const std::string& name, int bpp, bool affine, const std::shared_ptr<Palette>& palette = nullptr);
+        Tileset(const ImageBands& images, const std::string& name, int bpp, bool affine, const std::shared_ptr<Palette>& palette = nullptr);
         static Tileset* FromImage(const Image16Bpp& image, int bpp, bool affine);
-        int Search(const Tile& tile) const;
+        /** Finds tile, or when flips are matched a tile which shown with flip equals tile */
+        int Search(const Tile& tile, int& flip) const;
         int Search(const ImageTile& tile) const;
-        // Match Imagetile to Tile (only for bpp = 4)
-        bool Match(const ImageTile& tile, int& tile_id, int& pal_id) const;
-        unsigned int Size() const {return tiles.size() * ((bpp == 4) ? TILE_SIZE_SHORTS_4BPP : (bpp == 8) ? TILE_SIZE_SHORTS_8BPP : 1);};
+        // Match Imagetile to Tile (only for bpp = 4 or 8)
+        bool Match(const ImageTile& tile, int& tile_id, int& pal_id, int& flip) const;
+        /** Matches tile as the ImageTile looking closest to it, flipped when flips are matched, was. distance is their TileDistance */
+        bool MatchNearest(const ImageTile& tile, int& tile_id, int& pal_id, int& flip, unsigned long& distance) const;
+        /** Bytes held by the tiles and their indexes */
+        size_t MemoryUsage() const;
+        unsigned int Size() const {return tilesExport.size() * ((bpp == 4) ? TILE_SIZE_SHORTS_4BPP : (bpp == 8) ? TILE_SIZE_SHORTS_8BPP : 1);};
         void WriteData(std::ostream& file) const;
         void WriteExport(std::ostream& file) const;
         int bpp;
         bool affine;
-        // Only one of two will be used bpp = 4 or 8: tiles 16: itiles
-        std::set<Tile> tiles;
-        std::set<ImageTile> itiles;
-        // Bookkeeping matcher used when bpp = 4 or 8
-        std::map<ImageTile, Tile> matcher;
-        // Tiles sorted by id for export.
+        /** Are tiles matched against flips of other tiles, never for affine tilesets */
+        bool match_flips;
+        // Tiles indexed by id, also the export order. Unused when bpp = 16.
         std::vector<Tile> tilesExport;
+        // Distinct ImageTiles indexed by id.
+        std::vector<ImageTile> itiles;
         // Only one max will be used bpp = 4: paletteBanks 8: palette 16: neither
         std::shared_ptr<Palette> palette;
         PaletteBankManager paletteBanks;
     private:
-        void Init4bpp(const std::vector<Image16Bpp>& images);
-        void Init8bpp(const std::vector<Image16Bpp>& images);
-        void Init16bpp(const std::vector<Image16Bpp>& images);
+        /** Tile and palette bank an ImageTile was reduced to */
+        struct TileMatch
+        {
+            int tile_id;
+            int palette_bank;
+            int flip;
+        };
+        void Init4bpp(const ImageBands& images);
+        void Init8bpp(const ImageBands& images);
+        void Init16bpp(const ImageBands& images);
+        /** Finds tile as Search does and gives the fingerprint it is indexed under */
+        int Find(const Tile& tile, uint64_t& key, int& flip) const;
+        /** Assigns tile its id, adding it to the tiles to export if no equal tile was added before */
+        void AddTile(Tile& tile, int& flip);
+        /** Assigns imageTile its id, adding it to itiles if no equal ImageTile was added before */
+        void AddImageTile(ImageTile& imageTile);
+        /** Merges the closest looking tiles until at most max_tiles are left, matches move to the tile kept */
+        void MergeSimilarTiles(unsigned int max_tiles);
+        void LogMemoryUsage() const;
+        TileIndex tilesIndex;
+        TileIndex itilesIndex;
+        // Bookkeeping matcher used when bpp = 4 or 8, indexed by ImageTile id, tile_id -1 if the ImageTile has no match.
+        std::vector<TileMatch> matches;
+        // Built by the first MatchNearest, LAB colors of itiles and the tree finding the closest of them.
+        mutable std::vector<TileLAB> itilesLAB;
+        mutable std::unique_ptr<TileTree> itilesTree;
         bool export_shared_data;
 };
 
@@ -0,0 +1,205 @@
+#include "vram-planner.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <set>
+
+#include "logger.hpp"
+#include "export_params.hpp"
+#include "map.hpp"
+#include "sprite.hpp"
+#include "tileset.hpp"
+
+#define VRAM_BG_SIZE 0x10000
+#define VRAM_OBJ_SIZE 0x8000
+#define VRAM_OBJ_BITMAP_SIZE 0x4000
+#define VRAM_SBBS 32
+#define VRAM_SBBS_PER_CBB 8
+
+/** Tileset or map to place, base and units are in screenblocks */
+struct VramItem
+{
+    std::string name;
+    bool tiles;
+    unsigned int size;
+    int units;
+    int base;
+};
+
+/** Places items index onwards in the screenblocks not used yet, tilesets at the lowest free charblock and maps at the
+  * highest free screenblocks first so the two grow towards each other. An item the same size as the one before is only
+  * placed past it, so no placement is tried twice. */
+static bool Place(std::vector<VramItem>& items, unsigned int index, uint32_t used, int free_units)
+{
+    if (index == items.size())
+        return true;
+
+    int needed = 0;
+    for (unsigned int i = index; i < items.size(); i++)
+        needed += items[i].units;
+    if (needed > free_units)
+        return false;
+
+    VramItem& item = items[index];
+    const VramItem* prev = index > 0 && items[index - 1].tiles == item.tiles && items[index - 1].units == item.units ? &items[index - 1] : nullptr;
+    int last = VRAM_SBBS - item.units;
+    uint32_t mask = item.units == VRAM_SBBS ? 0xFFFFFFFF : (1U << item.units) - 1;
+    for (int i = 0; i <= last; i += item.tiles ? VRAM_SBBS_PER_CBB : 1)
+    {
+        int unit = item.tiles ? i : last - i;
+        if (prev && (item.tiles ? unit <= prev->base : unit >= prev->base))
+            continue;
+        if (used & (mask << unit))
+            continue;
+        item.base = unit;
+        if (Place(items, index + 1, used | (mask << unit), free_units - item.units))
+            return true;
+    }
+    return false;
+}
+
+static std::string Report(const std::vector<VramItem>& items, bool placed)
+{
+    std::string report;
+    char buffer[1024];
+    unsigned int total = 0;
+    int num_tilesets = 0;
+    for (const auto& item : items)
+    {
+        num_tilesets += item.tiles;
+        snprintf(buffer, 1024, "\t%s %s: %u bytes, %d screenblocks", item.name.c_str(), item.tiles ? "tiles" : "map", item.size, item.units);
+        report += buffer;
+        if (placed)
+        {
+            snprintf(buffer, 1024, " at %s %d", item.tiles ? "charblock" : "screenblock", item.tiles ? item.base / VRAM_SBBS_PER_CBB : item.base);
+            report += buffer;
+        }
+        report += "\n";
+        total += item.units * SIZE_SBB_BYTES;
+    }
+    snprintf(buffer, 1024, "\tTotal: %u of %d bytes (%u%%), %d tilesets for %d charblocks", total, VRAM_BG_SIZE, total * 100 / VRAM_BG_SIZE,
+             num_tilesets, VRAM_SBBS / VRAM_SBBS_PER_CBB);
+    report += buffer;
+    return report;
+}
+
+std::vector<VramBase> PlanVram(const std::vector<std::unique_ptr<Exportable>>& exportables)
+{
+    std::vector<VramBase> bases;
+    if (params.device != "GBA")
+    {
+        WarnLog("VRAM planning is only done for the GBA, no charblocks or screenblocks given.");
+        return bases;
+    }
+
+    std::vector<VramItem> items;
+    std::map<const Tileset*, int> tilesets;
+    std::set<const Tileset*> streamed;
+    std::map<std::string, int> maps;
+    unsigned int sprites_size = 0;
+
+    // A tileset without a name of its own is named after the first map using it.
+    auto add_tileset = [&](const Tileset& tileset, const std::string& name)
+    {
+        if (tilesets.find(&tileset) != tilesets.end())
+            return;
+        tilesets[&tileset] = items.size();
+        items.push_back({tileset.name.empty() ? name : tileset.name, true, tileset.Size() * 2, 0, 0});
+    };
+    // Frames of an animated map are copied into the same screenblocks, streamed maps only need their slots of tiles in VRAM.
+    auto add_map = [&](const Map& map)
+    {
+        const std::string name = map.animated ? map.name : map.GetExportName();
+        add_tileset(*map.tileset, name);
+        auto found = maps.find(name);
+        if (found == maps.end())
+        {
+            maps[name] = items.size();
+            items.push_back({name, false, map.VramSize(), 0, 0});
+        }
+        else
+        {
+            VramItem& item = items[found->second];
+            item.size = std::max(item.size, map.VramSize());
+        }
+
+        if (map.stream)
+        {
+            VramItem& item = items[tilesets[map.tileset.get()]];
+            unsigned int size = map.stream->num_slots * (map.tileset->bpp == 4 ? TILE_SIZE_BYTES_4BPP : TILE_SIZE_BYTES_8BPP);
+            item.size = streamed.insert(map.tileset.get()).second ? size : std::max(item.size, size);
+        }
+    };
+
+    for (const auto& exportable : exportables)
+    {
+        Exportable* export_ptr = exportable.get();
+        Tileset* tileset = dynamic_cast<Tileset*>(export_ptr);
+        Map* map = dynamic_cast<Map*>(export_ptr);
+        MapScene* map_scene = dynamic_cast<MapScene*>(export_ptr);
+        SpriteScene* sprite_scene = dynamic_cast<SpriteScene*>(export_ptr);
+        if (tileset)
+        {
+            add_tileset(*tileset, tileset->name);
+        }
+        else if (map)
+        {
+            add_map(*map);
+        }
+        else if (map_scene)
+        {
+            add_tileset(*map_scene->tileset, map_scene->name);
+            for (const auto& image : map_scene->GetImages())
+                add_map(static_cast<const Map&>(*image));
+        }
+        else if (sprite_scene)
+        {
+            sprites_size += sprite_scene->Size() * 2;
+        }
+    }
+
+    if (sprites_size)
+    {
+        // In bitmap modes the bitmap takes the lower half of object VRAM.
+        unsigned int obj_size = params.for_bitmap ? VRAM_OBJ_BITMAP_SIZE : VRAM_OBJ_SIZE;
+        if (sprites_size > obj_size)
+            FatalLog("Sprites do not fit in object VRAM. Sprites need %u of %u bytes (%u%%).", sprites_size, obj_size, sprites_size * 100 / obj_size);
+        InfoLog("Sprites use %u of %u bytes of object VRAM (%u%%).", sprites_size, obj_size, sprites_size * 100 / obj_size);
+    }
+
+    if (items.empty())
+        return bases;
+
+    bool too_big = false;
+    for (auto& item : items)
+    {
+        item.units = std::max(1U, (item.size + SIZE_SBB_BYTES - 1) / SIZE_SBB_BYTES);
+        too_big = too_big || item.units > VRAM_SBBS;
+    }
+    // Tilesets first since only every eighth screenblock can start one, then the biggest first.
+    std::stable_sort(items.begin(), items.end(), [](const VramItem& a, const VramItem& b)
+    {
+        return a.tiles != b.tiles ? a.tiles : a.units > b.units;
+    });
+
+    if (too_big || !Place(items, 0, 0, VRAM_SBBS))
+    {
+        const std::string report = Report(items, false);
+        if (!params.force)
+            FatalLog("Tilesets and maps do not fit in background VRAM together. Use --force to override.\n%s", report.c_str());
+        WarnLog("Tilesets and maps do not fit in background VRAM together, no charblocks or screenblocks given.\n%s", report.c_str());
+        return bases;
+    }
+
+    InfoLog("VRAM plan\n%s", Report(items, true).c_str());
+    for (const auto& item : items)
+    {
+        if (item.tiles)
+            bases.push_back({item.name, "_CHARBLOCK", item.base / VRAM_SBBS_PER_CBB});
+        else
+            bases.push_back({item.name, "_SCREENBLOCK", item.base});
+    }
+    return bases;
+}
@@ -0,0 +1,22 @@
+#ifndef VRAM_PLANNER_HPP
+#define VRAM_PLANNER_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "exportable.hpp"
+
+/** Charblock of a tileset or screenblock of a map given by PlanVram, written as #define name##append base */
+struct VramBase
+{
+    std::string name;
+    std::string append;
+    int base;
+};
+
+/** Gives each tileset a charblock and each map its screenblocks so that none overlap in the 64KB of GBA background VRAM,
+  * and checks the sprite tiles fit in object VRAM. If nothing fits this is fatal with a report of what each one needs. */
+std::vector<VramBase> PlanVram(const std::vector<std::unique_ptr<Exportable>>& exportables);
+
+#endif
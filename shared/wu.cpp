@@ -0,0 +1,304 @@
+#include "quantizer.hpp"
+
+#include <algorithm>
+
+#include "logger.hpp"
+
+// Implements Xiaolin Wu's color quantizer from Graphics Gems vol. II, pp. 126-133.
+// Color16 components are already 5 bits so the moment tables cover the whole color cube.
+
+#define WU_SIDE 33
+#define WU_INDEX(r, g, b) ((r) * WU_SIDE * WU_SIDE + (g) * WU_SIDE + (b))
+
+typedef enum {WU_RED, WU_GREEN, WU_BLUE} wuAxis;
+
+struct WuBox
+{
+    int r0, r1;
+    int g0, g1;
+    int b0, b1;
+    int vol;
+};
+
+/** Cumulative moments of the color cube, index 0 of each axis is padding */
+class WuMoments
+{
+    public:
+        WuMoments(const std::vector<ColorCount>& colors);
+        long Vol(const WuBox& cube, const std::vector<long>& mmt) const;
+        double Var(const WuBox& cube) const;
+        double Maximize(const WuBox& cube, wuAxis dir, int first, int last, int& cut, long whole_r, long whole_g, long whole_b, long whole_w) const;
+        bool Cut(WuBox& set1, WuBox& set2) const;
+        std::vector<long> wt, mr, mg, mb;
+        std::vector<double> m2;
+    private:
+        long Bottom(const WuBox& cube, wuAxis dir, const std::vector<long>& mmt) const;
+        long Top(const WuBox& cube, wuAxis dir, int pos, const std::vector<long>& mmt) const;
+};
+
+WuMoments::WuMoments(const std::vector<ColorCount>& colors) : wt(WU_SIDE * WU_SIDE * WU_SIDE), mr(wt.size()), mg(wt.size()), mb(wt.size()), m2(wt.size())
+{
+    for (const auto& color_count : colors)
+    {
+        const Color16& color = color_count.color;
+        long count = color_count.count;
+        int r = color.r & 0x1F;
+        int g = color.g & 0x1F;
+        int b = color.b & 0x1F;
+        int index = WU_INDEX(r + 1, g + 1, b + 1);
+        wt[index] += count;
+        mr[index] += r * count;
+        mg[index] += g * count;
+        mb[index] += b * count;
+        m2[index] += (double)(r * r + g * g + b * b) * count;
+    }
+
+    // Convert to cumulative moments so any box can be summed with 8 lookups.
+    for (int r = 1; r < WU_SIDE; r++)
+    {
+        long area[WU_SIDE] = {0}, area_r[WU_SIDE] = {0}, area_g[WU_SIDE] = {0}, area_b[WU_SIDE] = {0};
+        double area2[WU_SIDE] = {0};
+        for (int g = 1; g < WU_SIDE; g++)
+        {
+            long line = 0, line_r = 0, line_g = 0, line_b = 0;
+            double line2 = 0;
+            for (int b = 1; b < WU_SIDE; b++)
+            {
+                int index = WU_INDEX(r, g, b);
+                int prev = WU_INDEX(r - 1, g, b);
+                line += wt[index];
+                line_r += mr[index];
+                line_g += mg[index];
+                line_b += mb[index];
+                line2 += m2[index];
+                area[b] += line;
+                area_r[b] += line_r;
+                area_g[b] += line_g;
+                area_b[b] += line_b;
+                area2[b] += line2;
+                wt[index] = wt[prev] + area[b];
+                mr[index] = mr[prev] + area_r[b];
+                mg[index] = mg[prev] + area_g[b];
+                mb[index] = mb[prev] + area_b[b];
+                m2[index] = m2[prev] + area2[b];
+            }
+        }
+    }
+}
+
+long WuMoments::Vol(const WuBox& cube, const std::vector<long>& mmt) const
+{
+    return mmt[WU_INDEX(cube.r1, cube.g1, cube.b1)] - mmt[WU_INDEX(cube.r1, cube.g1, cube.b0)] -
+           mmt[WU_INDEX(cube.r1, cube.g0, cube.b1)] + mmt[WU_INDEX(cube.r1, cube.g0, cube.b0)] -
+           mmt[WU_INDEX(cube.r0, cube.g1, cube.b1)] + mmt[WU_INDEX(cube.r0, cube.g1, cube.b0)] +
+           mmt[WU_INDEX(cube.r0, cube.g0, cube.b1)] - mmt[WU_INDEX(cube.r0, cube.g0, cube.b0)];
+}
+
+long WuMoments::Bottom(const WuBox& cube, wuAxis dir, const std::vector<long>& mmt) const
+{
+    switch (dir)
+    {
+        case WU_RED:
+            return -mmt[WU_INDEX(cube.r0, cube.g1, cube.b1)] + mmt[WU_INDEX(cube.r0, cube.g1, cube.b0)] +
+                    mmt[WU_INDEX(cube.r0, cube.g0, cube.b1)] - mmt[WU_INDEX(cube.r0, cube.g0, cube.b0)];
+        case WU_GREEN:
+            return -mmt[WU_INDEX(cube.r1, cube.g0, cube.b1)] + mmt[WU_INDEX(cube.r1, cube.g0, cube.b0)] +
+                    mmt[WU_INDEX(cube.r0, cube.g0, cube.b1)] - mmt[WU_INDEX(cube.r0, cube.g0, cube.b0)];
+        case WU_BLUE:
+            return -mmt[WU_INDEX(cube.r1, cube.g1, cube.b0)] + mmt[WU_INDEX(cube.r1, cube.g0, cube.b0)] +
+                    mmt[WU_INDEX(cube.r0, cube.g1, cube.b0)] - mmt[WU_INDEX(cube.r0, cube.g0, cube.b0)];
+    }
+    return 0;
+}
+
+long WuMoments::Top(const WuBox& cube, wuAxis dir, int pos, const std::vector<long>& mmt) const
+{
+    switch (dir)
+    {
+        case WU_RED:
+            return mmt[WU_INDEX(pos, cube.g1, cube.b1)] - mmt[WU_INDEX(pos, cube.g1, cube.b0)] -
+                   mmt[WU_INDEX(pos, cube.g0, cube.b1)] + mmt[WU_INDEX(pos, cube.g0, cube.b0)];
+        case WU_GREEN:
+            return mmt[WU_INDEX(cube.r1, pos, cube.b1)] - mmt[WU_INDEX(cube.r1, pos, cube.b0)] -
+                   mmt[WU_INDEX(cube.r0, pos, cube.b1)] + mmt[WU_INDEX(cube.r0, pos, cube.b0)];
+        case WU_BLUE:
+            return mmt[WU_INDEX(cube.r1, cube.g1, pos)] - mmt[WU_INDEX(cube.r1, cube.g0, pos)] -
+                   mmt[WU_INDEX(cube.r0, cube.g1, pos)] + mmt[WU_INDEX(cube.r0, cube.g0, pos)];
+    }
+    return 0;
+}
+
+double WuMoments::Var(const WuBox& cube) const
+{
+    double dr = Vol(cube, mr);
+    double dg = Vol(cube, mg);
+    double db = Vol(cube, mb);
+    double xx = m2[WU_INDEX(cube.r1, cube.g1, cube.b1)] - m2[WU_INDEX(cube.r1, cube.g1, cube.b0)] -
+                m2[WU_INDEX(cube.r1, cube.g0, cube.b1)] + m2[WU_INDEX(cube.r1, cube.g0, cube.b0)] -
+                m2[WU_INDEX(cube.r0, cube.g1, cube.b1)] + m2[WU_INDEX(cube.r0, cube.g1, cube.b0)] +
+                m2[WU_INDEX(cube.r0, cube.g0, cube.b1)] - m2[WU_INDEX(cube.r0, cube.g0, cube.b0)];
+
+    return xx - (dr * dr + dg * dg + db * db) / Vol(cube, wt);
+}
+
+double WuMoments::Maximize(const WuBox& cube, wuAxis dir, int first, int last, int& cut, long whole_r, long whole_g, long whole_b, long whole_w) const
+{
+    long base_r = Bottom(cube, dir, mr);
+    long base_g = Bottom(cube, dir, mg);
+    long base_b = Bottom(cube, dir, mb);
+    long base_w = Bottom(cube, dir, wt);
+
+    double max = 0.0;
+    cut = -1;
+    for (int i = first; i < last; i++)
+    {
+        double half_r = base_r + Top(cube, dir, i, mr);
+        double half_g = base_g + Top(cube, dir, i, mg);
+        double half_b = base_b + Top(cube, dir, i, mb);
+        double half_w = base_w + Top(cube, dir, i, wt);
+
+        // Empty halves can't be the best cut.
+        if (half_w == 0)
+            continue;
+
+        double temp = (half_r * half_r + half_g * half_g + half_b * half_b) / half_w;
+
+        half_r = whole_r - half_r;
+        half_g = whole_g - half_g;
+        half_b = whole_b - half_b;
+        half_w = whole_w - half_w;
+        if (half_w == 0)
+            continue;
+
+        temp += (half_r * half_r + half_g * half_g + half_b * half_b) / half_w;
+
+        if (temp > max)
+        {
+            max = temp;
+            cut = i;
+        }
+    }
+
+    return max;
+}
+
+bool WuMoments::Cut(WuBox& set1, WuBox& set2) const
+{
+    long whole_r = Vol(set1, mr);
+    long whole_g = Vol(set1, mg);
+    long whole_b = Vol(set1, mb);
+    long whole_w = Vol(set1, wt);
+
+    int cut_r, cut_g, cut_b;
+    double max_r = Maximize(set1, WU_RED, set1.r0 + 1, set1.r1, cut_r, whole_r, whole_g, whole_b, whole_w);
+    double max_g = Maximize(set1, WU_GREEN, set1.g0 + 1, set1.g1, cut_g, whole_r, whole_g, whole_b, whole_w);
+    double max_b = Maximize(set1, WU_BLUE, set1.b0 + 1, set1.b1, cut_b, whole_r, whole_g, whole_b, whole_w);
+
+    wuAxis dir;
+    if (max_r >= max_g && max_r >= max_b)
+    {
+        dir = WU_RED;
+        // Can't split the box
+        if (cut_r < 0)
+            return false;
+    }
+    else if (max_g >= max_r && max_g >= max_b)
+        dir = WU_GREEN;
+    else
+        dir = WU_BLUE;
+
+    set2.r1 = set1.r1;
+    set2.g1 = set1.g1;
+    set2.b1 = set1.b1;
+
+    switch (dir)
+    {
+        case WU_RED:
+            set2.r0 = set1.r1 = cut_r;
+            set2.g0 = set1.g0;
+            set2.b0 = set1.b0;
+            break;
+        case WU_GREEN:
+            set2.g0 = set1.g1 = cut_g;
+            set2.r0 = set1.r0;
+            set2.b0 = set1.b0;
+            break;
+        case WU_BLUE:
+            set2.b0 = set1.b1 = cut_b;
+            set2.r0 = set1.r0;
+            set2.g0 = set1.g0;
+            break;
+    }
+
+    set1.vol = (set1.r1 - set1.r0) * (set1.g1 - set1.g0) * (set1.b1 - set1.b0);
+    set2.vol = (set2.r1 - set2.r0) * (set2.g1 - set2.g0) * (set2.b1 - set2.b0);
+
+    return true;
+}
+
+void WuQuantizer::Quantize(const std::vector<ColorCount>& colors, unsigned int num_colors, std::vector<Color16>& palette) const
+{
+    EventLog l(__func__);
+
+    if (colors.empty() || num_colors == 0)
+        return;
+
+    WuMoments moments(colors);
+
+    std::vector<WuBox> cubes(num_colors);
+    std::vector<double> vv(num_colors);
+    cubes[0].r0 = cubes[0].g0 = cubes[0].b0 = 0;
+    cubes[0].r1 = cubes[0].g1 = cubes[0].b1 = WU_SIDE - 1;
+    cubes[0].vol = (WU_SIDE - 1) * (WU_SIDE - 1) * (WU_SIDE - 1);
+
+    unsigned int num_cubes = num_colors;
+    int next = 0;
+    for (unsigned int i = 1; i < num_colors; i++)
+    {
+        if (moments.Cut(cubes[next], cubes[i]))
+        {
+            // Volume test ensures we won't try to cut a single cell.
+            vv[next] = cubes[next].vol > 1 ? moments.Var(cubes[next]) : 0.0;
+            vv[i] = cubes[i].vol > 1 ? moments.Var(cubes[i]) : 0.0;
+        }
+        else
+        {
+            // Don't try to split this box again.
+            vv[next] = 0.0;
+            i--;
+        }
+
+        next = 0;
+        double temp = vv[0];
+        for (unsigned int k = 1; k <= i; k++)
+        {
+            if (vv[k] > temp)
+            {
+                temp = vv[k];
+                next = k;
+            }
+        }
+
+        if (temp <= 0.0)
+        {
+            num_cubes = i + 1;
+            break;
+        }
+    }
+
+    VerboseLog("Wu quantizer found %d boxes for %d colors", num_cubes, num_colors);
+
+    for (unsigned int k = 0; k < num_cubes; k++)
+    {
+        long weight = moments.Vol(cubes[k], moments.wt);
+        if (!weight)
+            continue;
+
+        int r = (moments.Vol(cubes[k], moments.mr) + weight / 2) / weight;
+        int g = (moments.Vol(cubes[k], moments.mg) + weight / 2) / weight;
+        int b = (moments.Vol(cubes[k], moments.mb) + weight / 2) / weight;
+        Color16 color(r, g, b);
+        if (std::find(palette.begin(), palette.end(), color) == palette.end())
+            palette.push_back(color);
+    }
+}